@@ -0,0 +1,82 @@
+#include "alloc.h"
+
+#include <algorithm>
+
+#ifdef RT_COUNT_ALLOCATIONS
+
+#include <new>
+
+static thread_local size_t threadAllocations = 0;
+
+size_t ThreadAllocationCount()
+{
+    return threadAllocations;
+}
+
+void* operator new(std::size_t size)
+{
+    ++threadAllocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++threadAllocations;
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+#endif
+
+void* Arena::Allocate(size_t size, size_t align)
+{
+    size_t start = 0;
+    while (current < blocks.size())
+    {
+        start = (offset + align - 1) & ~(align - 1);
+        if (start + size <= blocks[current].size) break;
+        // the rest of the block is wasted, kept blocks that are too small are skipped
+        ++current;
+        offset = 0;
+    }
+    if (current == blocks.size())
+    {
+        // blocks come from new, aligned for any fundamental type
+        size_t bytes = std::max(blockSize, size);
+        blocks.push_back({new char[bytes], bytes});
+        reserved += bytes;
+        start = 0;
+    }
+    used += start - offset + size;
+    offset = start + size;
+    return blocks[current].data + start;
+}
+
+void Arena::Reset()
+{
+    current = 0;
+    offset = 0;
+    used = 0;
+}
+
+void Arena::Release()
+{
+    for (auto& block: blocks)
+    {
+        delete[] block.data;
+    }
+    blocks.clear();
+    reserved = 0;
+    Reset();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include <new>
+#include <type_traits>
+
+/*
+ * Heap allocation counting for debug builds, enabled by RT_COUNT_ALLOCATIONS.
+ * Global operator new is replaced to count the calls made by each thread,
+ * which lets the renderer check that tracing stays off the heap.
+ */
+#ifdef RT_COUNT_ALLOCATIONS
+// number of operator new calls made by the calling thread so far
+size_t ThreadAllocationCount();
+#endif
+
+/*
+ * Bump allocator for scene storage. Allocations are carved out of large
+ * blocks one after another, so things allocated in a row sit next to each
+ * other in memory, and all of them are freed at once by Reset. Destructors
+ * are never run, only trivially destructible types belong in an arena.
+ * Not thread-safe.
+ */
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = 1 << 20) : blockSize(blockSize) { }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() { Release(); }
+
+    void* Allocate(size_t size, size_t align);
+
+    template <class T, class... Args>
+    T* New(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /* Drop every allocation, the blocks are kept for reuse */
+    void Reset();
+
+    /* Drop every allocation and free the blocks */
+    void Release();
+
+    /* Bytes handed out since the last Reset, padding included */
+    size_t Used() const { return used; }
+
+    /* Bytes of all blocks */
+    size_t Reserved() const { return reserved; }
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t current = 0;     // block allocations are made from
+    size_t offset = 0;      // first free byte in it
+    size_t used = 0;
+    size_t reserved = 0;
+};
@@ -0,0 +1,1342 @@
+/*
+ * Performance benchmarks for the ray tracer.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <omp.h>
+
+#include "stdafx.h"
+#include "object.h"
+#include "common.h"
+#include "material.h"
+#include "rng.h"
+#include "spheresoa.h"
+#include "raypacket.h"
+#include "integrator.h"
+#include "wavefront.h"
+#include "framebuffer.h"
+#include "scene.h"
+#include "meshloader.h"
+#include "checkpoint.h"
+#include "distributed.h"
+
+using namespace std;
+
+static double SecondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// random spheres in a 100^3 cube, sized so that the density stays constant
+static void RandomSpheres(Objects& objects, int n, const Material& m)
+{
+    double radius = 0.3 * 50 * cbrt(1.0 / n);
+    for (int i = 0; i < n; ++i)
+    {
+        Vector3 center{drand48() * 100 - 50, drand48() * 100 - 50, drand48() * 100 - 50};
+        objects.Add(new Sphere(center, radius, m));
+    }
+}
+
+/*
+ * The small scene of the checkpoint and distributed benchmarks: a diffuse
+ * ball and a metal one on a huge ground ball, under an emissive sun. The
+ * scene holds the materials of the objects it adds.
+ */
+struct TestScene
+{
+    Lambertian ground{Vector3(0.6, 0.6, 0.8)}, diffuse{Vector3(0.8, 0.5, 0.5)};
+    Metal metal{Vector3(0.8, 0.6, 0.2)};
+    Emissive sunlight{Color(4, 4, 3.6)};
+    // stands in for Scene::Fingerprint in checkpoints, the scene is built in code
+    static const uint64_t fingerprint = 0x7e575ce7e;
+
+    TestScene(Objects& objects)
+    {
+        objects.Add(new Sphere({0, -1000.5, -1}, 1000, ground));
+        objects.Add(new Sphere({1, 0, -1}, 0.5, diffuse));
+        objects.Add(new Sphere({-1, 0, -1}, 0.5, metal));
+        objects.Add(new Sphere({-1, 8, -5}, 3, sunlight));
+    }
+
+    /* Looking down at the balls from a little above the ground */
+    static Camera MakeCamera(int nx, int ny)
+    {
+        Vector3 lookFrom{-5, 0.2, -5}, lookAt{0, 0, -1};
+        return Camera(lookFrom, lookAt, {0, 1, 0}, 20, 0.2, (lookAt - lookFrom).Length(), nx, ny);
+    }
+};
+
+static double RaysPerSecond(Objects& objects, const vector<Ray>& rays, int count)
+{
+    auto start = chrono::steady_clock::now();
+    int hits = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        HitRecord hr;
+        hits += objects.IsHit(rays[i % rays.size()], 0, MAXFLOAT, hr);
+    }
+    double seconds = SecondsSince(start);
+    return count / seconds;
+}
+
+/*
+ * Intersection throughput of the BVH against the linear scan as the scene grows.
+ */
+void BenchBVH()
+{
+    Lambertian m({0.5, 0.5, 0.5});
+    vector<Ray> rays(4096);
+    for (auto& r: rays)
+    {
+        Vector3 from{drand48() * 100 - 50, drand48() * 100 - 50, -100};
+        Vector3 to{drand48() * 100 - 50, drand48() * 100 - 50, 100};
+        r = Ray(from, to - from);
+    }
+
+    printf("%-10s %14s %14s %10s %12s\n", "spheres", "linear ray/s", "bvh ray/s", "speedup", "build (ms)");
+    for (int n: {100, 1000, 10000, 100000, 1000000})
+    {
+        Objects objects;
+        RandomSpheres(objects, n, m);
+
+        auto start = chrono::steady_clock::now();
+        objects.Prepare();
+        double build = SecondsSince(start);
+
+        // keep the linear scan to roughly the same amount of sphere tests per size
+        objects.SetAcceleration(false);
+        double linear = RaysPerSecond(objects, rays, max(64, 20000000 / n));
+        objects.SetAcceleration(true);
+        double bvh = RaysPerSecond(objects, rays, 200000);
+        printf("%-10d %14.0f %14.0f %9.1fx %12.1f\n", n, linear, bvh, bvh / linear, build * 1000);
+    }
+}
+
+/*
+ * Intersection throughput of each sphere kernel the cpu supports. The BVH is
+ * rebuilt for each one since leaves are sized to the kernel's width.
+ */
+void BenchSphereKernels()
+{
+    Lambertian m({0.5, 0.5, 0.5});
+    vector<Ray> rays(4096);
+    for (auto& r: rays)
+    {
+        Vector3 from{drand48() * 100 - 50, drand48() * 100 - 50, -100};
+        Vector3 to{drand48() * 100 - 50, drand48() * 100 - 50, 100};
+        r = Ray(from, to - from);
+    }
+
+    const char* names[] = {"scalar", "avx2", "avx512"};
+    SimdLevel best = DetectSimd();
+    printf("%-10s %-8s %14s\n", "spheres", "kernel", "ray/s");
+    for (int n: {1000, 100000, 1000000})
+    {
+        for (int level = 0; level <= (int) best; ++level)
+        {
+            SetSphereKernel((SimdLevel) level);
+            Objects objects;
+            srand48(n);
+            RandomSpheres(objects, n, m);
+            objects.Prepare();
+            double rate = RaysPerSecond(objects, rays, 200000);
+            printf("%-10d %-8s %14.0f\n", n, names[level], rate);
+        }
+    }
+    SetSphereKernel(best);
+}
+
+/*
+ * Primary visibility throughput of single rays against 8x8 packets, for a
+ * pinhole camera looking into a sphere field. Both include scattering the hit.
+ */
+void BenchPackets()
+{
+    const int nx = 512, ny = 512, size = 8;
+    Lambertian m({0.5, 0.5, 0.5});
+    Vector3 eye{0, 0, -150};
+    auto cameraRay = [&](int i, int j) {
+        Vector3 target{(i + 0.5) * 100.0 / nx - 50, (j + 0.5) * 100.0 / ny - 50, -50};
+        return Ray(eye, target - eye);
+    };
+
+    printf("%-10s %14s %14s %10s\n", "spheres", "single ray/s", "packet ray/s", "speedup");
+    for (int n: {1000, 100000, 1000000})
+    {
+        Objects objects;
+        RandomSpheres(objects, n, m);
+        objects.Prepare();
+
+        auto start = chrono::steady_clock::now();
+        int hits = 0;
+        for (int j = 0; j < ny; ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                HitRecord hr;
+                hits += objects.IsHit(cameraRay(i, j), 0, MAXFLOAT, hr);
+            }
+        }
+        double single = nx * ny / SecondsSince(start);
+
+        start = chrono::steady_clock::now();
+        RayPacket packet;
+        int packetHits = 0;
+        for (int y = 0; y < ny; y += size)
+        {
+            for (int x = 0; x < nx; x += size)
+            {
+                packet.Clear();
+                for (int j = y; j < y + size; ++j)
+                {
+                    for (int i = x; i < x + size; ++i) packet.Add(cameraRay(i, j));
+                }
+                packet.Prepare(MAXFLOAT);
+                objects.IsHit(packet, 0);
+                for (int k = 0; k < packet.size; ++k)
+                {
+                    if (packet.object[k] < 0) continue;
+                    HitRecord hr;
+                    objects.Shade(packet.rays[k], {packet.tMax[k], packet.object[k]}, 0, hr);
+                    ++packetHits;
+                }
+            }
+        }
+        double packets = nx * ny / SecondsSince(start);
+        printf("%-10d %14.0f %14.0f %9.2fx%s\n", n, single, packets, packets / single,
+               hits == packetHits ? "" : "  (hit counts differ)");
+    }
+}
+
+/*
+ * Full paths through a DrawBalls-like scene: the recursive ColorBalls2, the
+ * iterative PathTracer and the WavefrontTracer, in rays and samples per second.
+ */
+void BenchWavefront()
+{
+    Objects objects;
+    Lambertian ground({0.6, 0.6, 0.8}), diffuse({0.8, 0.5, 0.5});
+    Metal metal({0.8, 0.6, 0.2});
+    Glass glass(1.5);
+    const Material* materials[] = {&diffuse, &metal, &glass};
+    objects.Add(new Sphere({0, -1000.5, -1}, 1000, ground));
+    objects.Add(new Sphere({0, 0, -1}, 0.5, glass));
+    objects.Add(new Sphere({1, 0, -1}, 0.5, diffuse));
+    objects.Add(new Sphere({-1, 0, -1}, 0.5, metal));
+    Rng rng(2018, 0);
+    for (int i = 0; i < 100; ++i)
+    {
+        Vector3 center{rng.NextDouble() * 10 - 5, -0.3, rng.NextDouble() * 10 - 5};
+        objects.Add(new Sphere(center, 0.2, *materials[i % 3]));
+    }
+    objects.Prepare();
+
+    // the camera rays and generator states of 4 samples of a 320x180 image
+    const int nx = 320, ny = 180, samples = 4;
+    Vector3 lookFrom{-5, 0.2, -5}, lookAt{0, 0, -1};
+    Camera camera(lookFrom, lookAt, {0, 1, 0}, 20, 0.2, (lookAt - lookFrom).Length(), nx, ny);
+    vector<Ray> rays;
+    vector<Rng> rngs;
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            for (int k = 0; k < samples; ++k)
+            {
+                SeedThreadRng((uint64_t) j * nx + i, k, 0);
+                rays.push_back(camera.GetRay((i + RandomDouble()) / nx, (j + RandomDouble()) / ny));
+                rngs.push_back(ThreadRng());
+            }
+        }
+    }
+    int count = (int) rays.size();
+    vector<Color> colors(count);
+
+    printf("%-12s %14s %14s\n", "integrator", "ray/s", "sample/s");
+    auto report = [&](const char* name, int64_t traced, double seconds) {
+        printf("%-12s %14.0f %14.0f\n", name, traced / seconds, count / seconds);
+    };
+    int64_t raysBefore = ThreadRayCount();
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        ThreadRng() = rngs[i];
+        colors[i] = ColorBalls2(rays[i], objects);
+    }
+    report("recursive", ThreadRayCount() - raysBefore, SecondsSince(start));
+
+    PathTracer tracer(ColorSky);
+    raysBefore = ThreadRayCount();
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        ThreadRng() = rngs[i];
+        colors[i] = tracer(rays[i], objects, 0);
+    }
+    report("path", ThreadRayCount() - raysBefore, SecondsSince(start));
+
+    WavefrontTracer wavefront(ColorSky);
+    int64_t traced = 0;
+    start = chrono::steady_clock::now();
+    for (int first = 0; first < count; first += 4096)
+    {
+        traced += wavefront(&rays[first], &rngs[first], min(4096, count - first), objects, &colors[first]);
+    }
+    report("wavefront", traced, SecondsSince(start));
+}
+
+/*
+ * Noise of a small sun lit scene at equal sample counts with and without
+ * light sampling, as the rms error against a light sampled reference.
+ */
+void BenchLightSampling()
+{
+    Objects objects;
+    Lambertian ground({0.6, 0.6, 0.8}), diffuse({0.8, 0.5, 0.5});
+    Emissive sunlight({40, 40, 36});
+    objects.Add(new Sphere({0, -1000.5, -1}, 1000, ground));
+    objects.Add(new Sphere({1, 0, -1}, 0.5, diffuse));
+    objects.Add(new Sphere({-1, 0, -1}, 0.5, ground));
+    objects.Add(new Sphere({-1, 8, -5}, 0.5, sunlight));
+    objects.Prepare();
+
+    const int nx = 128, ny = 72, referenceSamples = 1024;
+    Vector3 lookFrom{-5, 0.2, -5}, lookAt{0, 0, -1};
+    Camera camera(lookFrom, lookAt, {0, 1, 0}, 20, 0, (lookAt - lookFrom).Length(), nx, ny);
+    // mean of `samples` samples per pixel, the same camera rays for either tracer
+    auto render = [&](const PathTracer& tracer, int samples, vector<Color>& image) {
+        image.assign(nx * ny, {0, 0, 0});
+        #pragma omp parallel for schedule(dynamic)
+        for (int j = 0; j < ny; ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                Color sum{0, 0, 0};
+                for (int k = 0; k < samples; ++k)
+                {
+                    SeedThreadRng((uint64_t) j * nx + i, k, 0);
+                    Ray r = camera.GetRay((i + RandomDouble()) / nx, (j + RandomDouble()) / ny);
+                    sum += tracer(r, objects, 0);
+                }
+                image[j * nx + i] = sum / samples;
+            }
+        }
+    };
+
+    PathTracer bsdf(ColorSkyGradient), nee(ColorSkyGradient);
+    nee.SetLightSampling(true);
+    vector<Color> reference, image;
+    render(nee, referenceSamples, reference);
+    auto rmse = [&]() {
+        double sum = 0;
+        for (int p = 0; p < nx * ny; ++p)
+        {
+            Vector3 d = image[p] - reference[p];
+            sum += d.Dot(d) / 3;
+        }
+        return sqrt(sum / (nx * ny));
+    };
+
+    printf("%-10s %12s %12s %12s %12s\n", "samples", "bsdf rmse", "nee rmse", "bsdf ms", "nee ms");
+    for (int samples: {4, 16, 64})
+    {
+        auto start = chrono::steady_clock::now();
+        render(bsdf, samples, image);
+        double bsdfTime = SecondsSince(start);
+        double bsdfError = rmse();
+        start = chrono::steady_clock::now();
+        render(nee, samples, image);
+        double neeTime = SecondsSince(start);
+        printf("%-10d %12.4f %12.4f %12.1f %12.1f\n", samples, bsdfError, rmse(),
+               bsdfTime * 1000, neeTime * 1000);
+    }
+}
+
+/*
+ * Error of full Camera renders at equal sample counts for each sampler,
+ * against a high sample count reference, with defocus blur and light sampling.
+ */
+void BenchSamplers()
+{
+    Objects objects;
+    Lambertian ground({0.6, 0.6, 0.8}), diffuse({0.8, 0.5, 0.5});
+    Metal metal({0.8, 0.6, 0.2});
+    Emissive sunlight({4, 4, 3.6});
+    objects.Add(new Sphere({0, -1000.5, -1}, 1000, ground));
+    objects.Add(new Sphere({1, 0, -1}, 0.5, diffuse));
+    objects.Add(new Sphere({-1, 0, -1}, 0.5, metal));
+    objects.Add(new Sphere({0, 0, -2.5}, 0.5, ground));
+    objects.Add(new Sphere({-1, 8, -5}, 3, sunlight));
+
+    const int nx = 160, ny = 90, referenceSamples = 2048;
+    const char* path = "bench_sampler.ppm";
+    Vector3 lookFrom{-5, 0.2, -5}, lookAt{0, 0, -1};
+    PathTracer tracer(ColorSkyGradient);
+    tracer.SetLightSampling(true);
+    // mean of every pixel after rendering `samples` samples with the sampler
+    auto render = [&](SamplerType type, int samples, vector<Color>& image) {
+        Camera camera(lookFrom, lookAt, {0, 1, 0}, 20, 0.2, (lookAt - lookFrom).Length(), nx, ny);
+        camera.SetColorHandler(tracer);
+        camera.SetAaSamples(samples);
+        camera.SetSampler(type);
+        camera.SetProgress(ProgressMode::Off);
+        CachedPPM ppm(nx, ny, path);
+        camera.Render(ppm, objects);
+        image.resize(nx * ny);
+        for (int j = 0; j < ny; ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                const Pixel& p = ppm.Buffer().At(i, j);
+                image[j * nx + i] = Color(p.r, p.g, p.b) / p.n;
+            }
+        }
+    };
+
+    vector<Color> reference, image;
+    render(SamplerType::Sobol, referenceSamples, reference);
+    const char* names[] = {"independent", "stratified", "sobol", "blue noise"};
+    printf("%-12s %10s %10s %10s %10s\n", "sampler", "4 spp", "16 spp", "64 spp", "ms@64");
+    for (int type = 0; type < 4; ++type)
+    {
+        printf("%-12s", names[type]);
+        double seconds = 0;
+        for (int samples: {4, 16, 64})
+        {
+            auto start = chrono::steady_clock::now();
+            render((SamplerType) type, samples, image);
+            seconds = SecondsSince(start);
+            double sum = 0;
+            for (int p = 0; p < nx * ny; ++p)
+            {
+                Vector3 d = image[p] - reference[p];
+                sum += d.Dot(d) / 3;
+            }
+            printf(" %10.4f", sqrt(sum / (nx * ny)));
+        }
+        printf(" %10.1f\n", seconds * 1000);
+    }
+    remove(path);
+}
+
+/*
+ * Scattering the hits of a mixed material scene through the virtual
+ * Material::Scatter against the material table kernels, in ns per hit.
+ */
+void BenchMaterials()
+{
+    Objects objects;
+    Lambertian ground({0.6, 0.6, 0.8});
+    // owned by their concrete types, Material has no virtual destructor
+    vector<unique_ptr<Lambertian>> lambertians;
+    vector<unique_ptr<Glass>> glasses;
+    vector<unique_ptr<Metal>> metals;
+    Rng rng(2018, 0);
+    for (int i = 0; i < 300; ++i)
+    {
+        double mrand = rng.NextDouble();
+        const Material* m;
+        if (mrand < 0.33)
+        {
+            lambertians.emplace_back(new Lambertian({rng.NextDouble(), rng.NextDouble(), rng.NextDouble()}));
+            m = lambertians.back().get();
+        }
+        else if (mrand < 0.66)
+        {
+            glasses.emplace_back(new Glass(1 + rng.NextDouble()));
+            m = glasses.back().get();
+        }
+        else
+        {
+            metals.emplace_back(new Metal({rng.NextDouble(), rng.NextDouble(), rng.NextDouble()}));
+            m = metals.back().get();
+        }
+        Vector3 center{rng.NextDouble() * 10 - 5, -0.3, rng.NextDouble() * 10 - 5};
+        objects.Add(new Sphere(center, 0.2, *m));
+    }
+    objects.Add(new Sphere({0, -1000.5, -1}, 1000, ground));
+    objects.Prepare();
+
+    // hits of rays from above, surfaces filled in up front so only scattering is timed
+    vector<Ray> rays;
+    vector<HitRecord> records;
+    vector<int> hitObjects;
+    for (int i = 0; i < 1 << 16; ++i)
+    {
+        Vector3 from{rng.NextDouble() * 10 - 5, 5, rng.NextDouble() * 10 - 5};
+        Ray r(from, {rng.NextDouble() - 0.5, -1, rng.NextDouble() - 0.5});
+        Hit hit;
+        if (!objects.Intersect(r, 0, MAXFLOAT, hit)) continue;
+        HitRecord hr;
+        objects.Surface(r, hit, 0, hr);
+        rays.push_back(r);
+        records.push_back(hr);
+        hitObjects.push_back(hit.object);
+    }
+
+    const int rounds = 20;
+    int n = (int) rays.size();
+    int64_t scattered = 0;
+    auto start = chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            HitRecord& hr = records[i];
+            hr.scatterInfos.clear();
+            objects.MaterialOf(hitObjects[i]).Scatter(rays[i], hr);
+            scattered += hr.scatterInfos.size();
+        }
+    }
+    double virtualTime = SecondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            HitRecord& hr = records[i];
+            hr.scatterInfos.clear();
+            ScatterBy(objects.MaterialAt(hitObjects[i]), rays[i], hr);
+            scattered -= hr.scatterInfos.size();
+        }
+    }
+    double tableTime = SecondsSince(start);
+    printf("%-10s %14s %14s %10s\n", "hits", "virtual ns", "table ns", "speedup");
+    printf("%-10d %14.1f %14.1f %9.2fx%s\n", n, virtualTime * 1e9 / (n * rounds), tableTime * 1e9 / (n * rounds),
+           virtualTime / tableTime, scattered == 0 ? "" : "  (scattered counts differ)");
+}
+
+/*
+ * Setting up and tearing down a scene of n spheres, each with its own
+ * material: one heap allocation per sphere and material given to Add,
+ * against spheres and materials stored in the scene's arena.
+ */
+void BenchSceneStorage()
+{
+    printf("%-10s %12s %12s %12s %12s %12s\n", "spheres", "heap setup", "heap free", "arena setup",
+           "arena free", "arena MB");
+    for (int n: {10000, 100000, 1000000})
+    {
+        Rng rng(n, 0);
+        auto center = [&]() {
+            return Vector3{rng.NextDouble() * 100 - 50, rng.NextDouble() * 100 - 50, rng.NextDouble() * 100 - 50};
+        };
+
+        auto start = chrono::steady_clock::now();
+        vector<unique_ptr<Lambertian>> materials;
+        materials.reserve(n);
+        Objects heap;
+        for (int i = 0; i < n; ++i)
+        {
+            materials.emplace_back(new Lambertian({rng.NextDouble(), rng.NextDouble(), rng.NextDouble()}));
+            heap.Add(new Sphere(center(), 0.1, *materials.back()));
+        }
+        double heapSetup = SecondsSince(start);
+        start = chrono::steady_clock::now();
+        heap.Release();
+        materials.clear();
+        double heapFree = SecondsSince(start);
+
+        start = chrono::steady_clock::now();
+        Objects scene;
+        for (int i = 0; i < n; ++i)
+        {
+            int m = scene.AddMaterial(Lambertian({rng.NextDouble(), rng.NextDouble(), rng.NextDouble()}));
+            scene.AddSphere(center(), 0.1, m);
+        }
+        double arenaSetup = SecondsSince(start);
+        double arenaMB = scene.Memory().arenaReserved / (1024.0 * 1024.0);
+        start = chrono::steady_clock::now();
+        scene.Release();
+        double arenaFree = SecondsSince(start);
+        printf("%-10d %12.1f %12.1f %12.1f %12.1f %12.1f\n", n, heapSetup * 1000, heapFree * 1000,
+               arenaSetup * 1000, arenaFree * 1000, arenaMB);
+    }
+}
+
+/*
+ * Startup time of a large scene: parsing the text file against mapping
+ * its binary cache, and building the objects from either.
+ */
+void BenchSceneLoading()
+{
+    const char* textPath = "/tmp/bench_scene.scene";
+    const char* cachePath = "/tmp/bench_scene.bin";
+    printf("%-10s %12s %12s %12s %12s %12s\n", "spheres", "text MB", "parse ms", "cache MB", "map ms", "build ms");
+    for (int n: {10000, 100000, 1000000})
+    {
+        Rng rng(n, 0);
+        FILE* f = fopen(textPath, "w");
+        fprintf(f, "image 192 108\n");
+        for (int m = 0; m < 64; ++m)
+        {
+            fprintf(f, "material m%d lambertian %.6f %.6f %.6f\n", m, rng.NextDouble(), rng.NextDouble(), rng.NextDouble());
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            fprintf(f, "sphere %.6f %.6f %.6f 0.1 m%d\n", rng.NextDouble() * 100 - 50, rng.NextDouble() * 100 - 50,
+                    rng.NextDouble() * 100 - 50, i % 64);
+        }
+        double textMB = ftell(f) / (1024.0 * 1024.0);
+        fclose(f);
+
+        string error;
+        Scene text;
+        auto start = chrono::steady_clock::now();
+        bool ok = text.LoadText(textPath, error);
+        double parse = SecondsSince(start);
+        ok = ok && text.SaveBinary(cachePath, error);
+
+        Scene cache;
+        start = chrono::steady_clock::now();
+        ok = ok && cache.LoadBinary(cachePath, error);
+        double map = SecondsSince(start);
+        if (!ok)
+        {
+            printf("%s\n", error.c_str());
+            return;
+        }
+
+        Objects objects;
+        start = chrono::steady_clock::now();
+        cache.Build(objects, error);
+        double build = SecondsSince(start);
+        double cacheMB = (sizeof(MaterialDesc) * cache.MaterialCount() + sizeof(SphereDesc) * cache.SphereCount()) /
+                         (1024.0 * 1024.0);
+        printf("%-10d %12.1f %12.1f %12.1f %12.2f %12.1f\n", n, textMB, parse * 1000, cacheMB, map * 1000,
+               build * 1000);
+    }
+    remove(textPath);
+    remove(cachePath);
+}
+
+/*
+ * Loading a heightfield of 2 x 708^2 (about a million) triangles from OBJ,
+ * ascii PLY and binary PLY, on one thread and on all of them, then
+ * building the scene from it. Time and memory are per million triangles.
+ */
+void BenchMeshLoading()
+{
+    const int k = 708;
+    const char* paths[] = {"/tmp/bench_mesh.obj", "/tmp/bench_mesh_ascii.ply", "/tmp/bench_mesh_binary.ply"};
+    const char* formats[] = {"obj", "ascii ply", "binary ply"};
+    auto height = [](int i, int j) { return (float) (sin(i * 0.05) * cos(j * 0.07)); };
+    FILE* obj = fopen(paths[0], "w");
+    FILE* ascii = fopen(paths[1], "w");
+    FILE* binary = fopen(paths[2], "wb");
+    int vertices = (k + 1) * (k + 1), faces = 2 * k * k;
+    const char* header = "ply\nformat %s 1.0\nelement vertex %d\nproperty float x\nproperty float y\nproperty float z\n"
+                         "element face %d\nproperty list uchar int vertex_indices\nend_header\n";
+    fprintf(ascii, header, "ascii", vertices, faces);
+    fprintf(binary, header, "binary_little_endian", vertices, faces);
+    for (int j = 0; j <= k; ++j)
+    {
+        for (int i = 0; i <= k; ++i)
+        {
+            float v[3] = {(float) i / k, height(i, j), (float) j / k};
+            fprintf(obj, "v %.6f %.6f %.6f\n", v[0], v[1], v[2]);
+            fprintf(ascii, "%.6f %.6f %.6f\n", v[0], v[1], v[2]);
+            fwrite(v, sizeof(float), 3, binary);
+        }
+    }
+    for (int j = 0; j < k; ++j)
+    {
+        for (int i = 0; i < k; ++i)
+        {
+            int a = j * (k + 1) + i, b = a + 1, c = a + k + 1, d = c + 1;
+            int tris[2][3] = {{a, c, b}, {b, c, d}};
+            for (auto& t: tris)
+            {
+                fprintf(obj, "f %d %d %d\n", t[0] + 1, t[1] + 1, t[2] + 1);
+                fprintf(ascii, "3 %d %d %d\n", t[0], t[1], t[2]);
+                unsigned char n = 3;
+                fwrite(&n, 1, 1, binary);
+                fwrite(t, sizeof(int), 3, binary);
+            }
+        }
+    }
+    fclose(obj);
+    fclose(ascii);
+    fclose(binary);
+
+    printf("%-12s %10s %14s %14s\n", "format", "file MB", "1 thread ms/M", "all ms/M");
+    TriangleMesh first;
+    for (int f = 0; f < 3; ++f)
+    {
+        const char* path = paths[f];
+        TriangleMesh mesh;
+        string error;
+        auto start = chrono::steady_clock::now();
+        bool ok = LoadMesh(path, mesh, error, 1);
+        double serial = SecondsSince(start);
+        start = chrono::steady_clock::now();
+        ok = ok && LoadMesh(path, mesh, error);
+        double parallel = SecondsSince(start);
+        if (!ok)
+        {
+            printf("%s\n", error.c_str());
+            return;
+        }
+        // the text files round the positions, only the faces are the same everywhere
+        bool same = first.indices.empty() || mesh.indices == first.indices;
+        if (first.indices.empty()) first = mesh;
+        ifstream file(path, ios::binary | ios::ate);
+        double millions = mesh.Triangles() / 1e6;
+        printf("%-12s %10.1f %14.1f %14.1f%s\n", formats[f], file.tellg() / (1024.0 * 1024.0),
+               serial * 1000 / millions, parallel * 1000 / millions, same ? "" : "  (meshes differ)");
+        remove(path);
+    }
+
+    Objects objects;
+    Lambertian m({0.5, 0.5, 0.5});
+    double millions = first.Triangles() / 1e6;
+    auto start = chrono::steady_clock::now();
+    objects.AddMesh(std::move(first), objects.AddMaterial(m));
+    objects.Prepare();
+    double build = SecondsSince(start);
+    SceneMemory memory = objects.Memory();
+    const double mb = 1024 * 1024;
+    printf("scene build %.1f ms/M triangles, %.1f MB/M triangles (mesh %.1f, triangles %.1f, bvh %.1f, other %.1f)\n",
+           build * 1000 / millions, memory.Total() / mb / millions, memory.meshes / mb / millions,
+           memory.arenaReserved / mb / millions, memory.bvh / mb / millions,
+           (memory.tables + memory.spheres) / mb / millions);
+}
+
+/*
+ * Cost of checkpointing a 1920x1080 render after every pass of 4 samples:
+ * the render time with and without checkpoints, and the time one
+ * checkpoint takes to write, which the writer thread hides.
+ */
+void BenchCheckpoint()
+{
+    Objects objects;
+    TestScene scene(objects);
+
+    const int nx = 1920, ny = 1080, samples = 16;
+    const char* path = "bench_checkpoint.ppm";
+    const char* checkpointPath = "bench_checkpoint.bin";
+    PathTracer tracer(ColorSkyGradient);
+    tracer.SetMaxDepth(4);
+    auto render = [&](bool checkpoints) {
+        Camera camera = TestScene::MakeCamera(nx, ny);
+        camera.SetColorHandler(tracer);
+        camera.SetAaSamples(samples);
+        camera.SetProgressive(4);
+        camera.SetProgress(ProgressMode::Off);
+        if (checkpoints)
+        {
+            camera.SetCheckpoint(checkpointPath, TestScene::fingerprint, 0, false);
+        }
+        CachedPPM ppm(nx, ny, path);
+        auto start = chrono::steady_clock::now();
+        camera.Render(ppm, objects);
+        return SecondsSince(start);
+    };
+    double plain = render(false);
+    double checkpointed = render(true);
+
+    Checkpoint checkpoint;
+    checkpoint.info = {nx, ny, 0, 0, samples, 4, 0, 0, 0, TestScene::fingerprint};
+    checkpoint.pixels.assign((size_t) nx * ny, Pixel{0.5f, 0.5f, 0.5f, 4});
+    string error;
+    auto start = chrono::steady_clock::now();
+    SaveCheckpoint(checkpointPath, checkpoint, error);
+    double write = SecondsSince(start);
+    ifstream file(checkpointPath, ios::binary | ios::ate);
+    double mb = file.tellg() / (1024.0 * 1024.0);
+    remove(checkpointPath);
+    remove(path);
+    printf("%-14s %12s %12s %12s %12s\n", "passes", "plain ms", "ckpt ms", "overhead", "write ms/MB");
+    printf("%-14d %12.1f %12.1f %11.1f%% %6.1f/%-5.1f\n", samples / 4, plain * 1000, checkpointed * 1000,
+           (checkpointed / plain - 1) * 100, write * 1000, mb);
+}
+
+/*
+ * One frame rendered by the threads of this process and by worker
+ * processes sharing its hardware threads: the cost of forking, shipping
+ * tiles and merging their buffers. Both images are the same.
+ */
+void BenchDistributed()
+{
+    Objects objects;
+    TestScene scene(objects);
+
+    const int nx = 640, ny = 360, samples = 32;
+    PathTracer tracer(ColorSkyGradient);
+    tracer.SetMaxDepth(8);
+    auto makeCamera = [&](Camera& camera) {
+        camera.SetColorHandler(tracer);
+        camera.SetAaSamples(samples);
+        camera.SetProgress(ProgressMode::Off);
+    };
+    printf("%-14s %12s %12s %10s\n", "processes", "ms", "Msamples/s", "same");
+    vector<Pixel> reference;
+    for (int workers = 0; workers <= 4; workers = workers ? workers * 2 : 1)
+    {
+        Camera camera = TestScene::MakeCamera(nx, ny);
+        makeCamera(camera);
+        CachedPPM ppm(nx, ny, nullptr);
+        auto start = chrono::steady_clock::now();
+        if (workers == 0)
+        {
+            camera.Render(ppm, objects);
+        }
+        else
+        {
+            DistributedSettings settings;
+            settings.workers = workers;
+            settings.progress = ProgressMode::Off;
+            string error;
+            if (!RenderDistributed(camera, objects, ppm, settings, error))
+            {
+                printf("%s\n", error.c_str());
+                return;
+            }
+        }
+        double seconds = SecondsSince(start);
+        const Pixel* pixels = ppm.Buffer().Data();
+        bool same = true;
+        if (workers == 0) reference.assign(pixels, pixels + (size_t) nx * ny);
+        else same = memcmp(reference.data(), pixels, reference.size() * sizeof(Pixel)) == 0;
+        printf("%-14s %12.1f %12.2f %10s\n", workers ? to_string(workers).c_str() : "threads", seconds * 1000,
+               (double) nx * ny * samples / seconds / 1e6, same ? "yes" : "NO");
+    }
+}
+
+/*
+ * End of frame latency: the time from the last pixel written to the image
+ * being on disk. Without streaming WriteToFile tonemaps and writes the whole
+ * image, with it the writer thread has written all but the last bands while
+ * the pixels came in.
+ */
+void BenchOutputLatency()
+{
+    const char* path = "bench_stream.ppm";
+    const int nx = 3840, ny = 2160;
+    printf("%-14s %12s %12s\n", "band rows", "pixels ms", "latency ms");
+    for (int bandHeight: {0, 8, 32, 128})
+    {
+        CachedPPM ppm(nx, ny, path);
+        ppm.SetStreaming(bandHeight);
+        ppm.StartStreaming();
+        Rng rng(7, 0);
+        auto start = chrono::steady_clock::now();
+        for (int j = ny - 1; j >= 0; --j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                ppm.Write(i, j, {rng.NextDouble(), rng.NextDouble(), rng.NextDouble()}, 1);
+            }
+        }
+        double pixels = SecondsSince(start);
+        start = chrono::steady_clock::now();
+        ppm.WriteToFile();
+        double latency = SecondsSince(start);
+        printf("%-14s %12.1f %12.2f\n", bandHeight ? to_string(bandHeight).c_str() : "off", pixels * 1000,
+               latency * 1000);
+    }
+    remove(path);
+}
+
+/*
+ * Per frame setup of an animation over 100K spheres of which 1000 move:
+ * refitting the BVH against building it anew, and the trace time of the
+ * refit tree after 60 frames of motion against a freshly built one.
+ */
+void BenchSequence()
+{
+    const int count = 100000, moving = 1000, frames = 60;
+    vector<Vector3> centers(count), velocities(moving);
+    Rng rng(3, 0);
+    for (auto& c: centers) c = {rng.NextDouble() * 100 - 50, rng.NextDouble() * 4, rng.NextDouble() * 100 - 50};
+    for (auto& v: velocities) v = {rng.NextDouble() * 0.2 - 0.1, 0, rng.NextDouble() * 0.2 - 0.1};
+    auto build = [&](Objects& objects, int frame) {
+        int material = objects.AddMaterial(Lambertian({0.5, 0.5, 0.5}));
+        objects.Reserve(count);
+        for (int i = 0; i < count; ++i)
+        {
+            Vector3 c = i < moving ? centers[i] + velocities[i] * frame : centers[i];
+            objects.AddSphere(c, 0.2, material);
+        }
+    };
+
+    Objects objects;
+    build(objects, 0);
+    auto start = chrono::steady_clock::now();
+    objects.Prepare();
+    double buildMs = SecondsSince(start) * 1000;
+    double refitMs = 0;
+    for (int frame = 1; frame <= frames; ++frame)
+    {
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < moving; ++i) objects.MoveSphere(i, centers[i] + velocities[i] * frame);
+        objects.Prepare();
+        refitMs += SecondsSince(start) * 1000;
+    }
+    Objects rebuilt;
+    build(rebuilt, frames);
+    rebuilt.Prepare();
+
+    auto trace = [&](Objects& scene) {
+        Camera camera({0, 30, 60}, {0, 0, 0}, {0, 1, 0}, 40, 0, 60, 320, 180);
+        PathTracer tracer(ColorSkyGradient);
+        tracer.SetMaxDepth(4);
+        camera.SetColorHandler(tracer);
+        camera.SetAaSamples(4);
+        camera.SetProgress(ProgressMode::Off);
+        CachedPPM ppm(320, 180, nullptr);
+        auto start = chrono::steady_clock::now();
+        camera.Render(ppm, scene);
+        return SecondsSince(start) * 1000;
+    };
+    printf("%-14s %12s %12s %14s %14s\n", "spheres", "build ms", "refit ms", "trace refit", "trace rebuilt");
+    printf("%-14d %12.1f %12.2f %14.1f %14.1f\n", count, buildMs, refitMs / frames, trace(objects), trace(rebuilt));
+}
+
+/*
+ * Random number throughput of drand48, which shares one global state,
+ * against the per-thread generator, with every thread drawing at once.
+ */
+void BenchRng()
+{
+    const int count = 20000000;
+    printf("%-10s %16s %16s\n", "threads", "drand48 num/s", "pcg32 num/s");
+    for (int threads = 1; threads <= omp_get_num_procs(); threads *= 2)
+    {
+        double sink = 0;
+        auto start = chrono::steady_clock::now();
+        #pragma omp parallel for num_threads(threads) reduction(+:sink)
+        for (int t = 0; t < threads; ++t)
+        {
+            for (int i = 0; i < count; ++i) sink += drand48();
+        }
+        double shared = count * (double) threads / SecondsSince(start);
+
+        start = chrono::steady_clock::now();
+        #pragma omp parallel for num_threads(threads) reduction(+:sink)
+        for (int t = 0; t < threads; ++t)
+        {
+            SeedThreadRng(t, 0, 0);
+            for (int i = 0; i < count; ++i) sink += RandomDouble();
+        }
+        double local = count * (double) threads / SecondsSince(start);
+        printf("%-10d %16.0f %16.0f%s\n", threads, shared, local, sink < 0 ? " " : "");
+    }
+}
+
+// the old text (P3) output, kept as a reference point
+static void WriteP3(const char* path, int nx, int ny, const Color* pix)
+{
+    ofstream fout(path);
+    fout << "P3\n" << nx << " " << ny << "\n255\n";
+    for (int i = 0; i < nx * ny; ++i)
+    {
+        fout << (int) pix[i].e[0] << "\t" << (int) pix[i].e[1] << "\t" << (int) pix[i].e[2] << "\n";
+    }
+}
+
+/*
+ * Time to write an image, per megapixel, for the binary writer and the old text one.
+ */
+void BenchImageWrite()
+{
+    const char* path = "bench_image.ppm";
+    printf("%-12s %14s %14s\n", "image", "P3 ms/MP", "P6 ms/MP");
+    int sizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+    for (auto& size: sizes)
+    {
+        int nx = size[0], ny = size[1];
+        double mp = nx * (double) ny / 1e6;
+        vector<Color> pix((size_t) nx * ny);
+        CachedPPM ppm(nx, ny, path);
+        for (int j = 0; j < ny; ++j)
+        {
+            for (int i = 0; i < nx; ++i)
+            {
+                Color c{drand48(), drand48(), drand48()};
+                pix[j * nx + i] = c * 255.99;
+                ppm.Write(i, j, c, 1);
+            }
+        }
+
+        auto start = chrono::steady_clock::now();
+        WriteP3(path, nx, ny, pix.data());
+        double text = SecondsSince(start);
+        start = chrono::steady_clock::now();
+        ppm.WriteToFile();
+        double binary = SecondsSince(start);
+        printf("%-12s %14.1f %14.1f\n", (to_string(nx) + "x" + to_string(ny)).c_str(),
+               text * 1000 / mp, binary * 1000 / mp);
+    }
+    remove(path);
+}
+
+//=========================== benchmark suite ==============================
+
+/* The demo scene with all its small spheres turned to glass, long refraction paths */
+static void GlassBallsScene(Scene& scene)
+{
+    Scene balls;
+    BallsScene(balls);
+    scene.Settings() = balls.Settings();
+    for (size_t i = 0; i < balls.MaterialCount(); ++i)
+    {
+        const MaterialDesc& m = balls.Materials()[i];
+        scene.AddMaterial((MaterialKind) m.kind, {m.color[0], m.color[1], m.color[2]}, m.ior);
+    }
+    int glass = scene.AddMaterial(MaterialKind::Glass, {1, 1, 1}, 1.5);
+    for (size_t i = 0; i < balls.SphereCount(); ++i)
+    {
+        const SphereDesc& sphere = balls.Spheres()[i];
+        scene.AddSphere({sphere.center[0], sphere.center[1], sphere.center[2]}, sphere.radius,
+                        sphere.radius < 0.3 ? glass : sphere.material);
+    }
+}
+
+/* 100K small spheres of random materials strewn over a ground plane, under the sun */
+static void SphereFieldScene(Scene& scene)
+{
+    RenderSettings& settings = scene.Settings();
+    double lookFrom[3] = {0, 12, 60}, lookAt[3] = {0, 0, 0};
+    copy(lookFrom, lookFrom + 3, settings.lookFrom);
+    copy(lookAt, lookAt + 3, settings.lookAt);
+    settings.vfov = 40;
+    settings.maxDepth = 8;
+    settings.sunSky = 1;
+    int ground = scene.AddMaterial(MaterialKind::Lambertian, {0.5, 0.5, 0.5});
+    scene.AddSphere({0, -10000, 0}, 10000, ground);
+    Rng rng(2019, 0);
+    int materials[8];
+    for (int m = 0; m < 8; ++m)
+    {
+        Color color{rng.NextDouble(), rng.NextDouble(), rng.NextDouble()};
+        materials[m] = scene.AddMaterial(m < 6 ? MaterialKind::Lambertian : MaterialKind::Metal, color);
+    }
+    for (int i = 0; i < 100000; ++i)
+    {
+        Vector3 center{rng.NextDouble() * 200 - 100, 0.25, rng.NextDouble() * 200 - 150};
+        scene.AddSphere(center, 0.25, materials[i % 8]);
+    }
+}
+
+/* Nothing but the sky: camera rays, misses and the frame buffer */
+static void SkyScene(Scene& scene)
+{
+    scene.Settings().sunSky = 1;
+}
+
+struct SuiteScene
+{
+    const char* name;
+    void (*make)(Scene&);
+    int nx, ny, samples;
+};
+
+/* One render of a suite scene */
+struct SuiteRun
+{
+    int threads;
+    double seconds;
+    int64_t rays, samples;
+};
+
+/* Per ray cost of the stages of the first bounce, replayed one stage at a time on one thread */
+struct SuiteStages
+{
+    double camera, intersect, shade;    // ns per camera ray
+    double output;                      // ms to tonemap and write the image
+};
+
+struct SuiteResult
+{
+    const SuiteScene* scene;
+    int objects;
+    double prepareMs;
+    SuiteStages stages;
+    vector<SuiteRun> runs;
+};
+
+static const SuiteScene SUITE_SCENES[] = {
+        {"balls", BallsScene, 480, 270, 16},
+        {"glass", GlassBallsScene, 480, 270, 16},
+        {"field", SphereFieldScene, 480, 270, 8},
+        {"sky", SkyScene, 960, 540, 16},
+};
+
+static void SetUpCamera(Camera& camera, const RenderSettings& settings, PathTracer& tracer)
+{
+    tracer.SetMaxDepth(settings.maxDepth);
+    tracer.SetLightSampling(settings.lightSampling != 0);
+    camera.SetColorHandler(tracer);
+    camera.SetPacketHandler(tracer, 8);
+    camera.SetAaSamples(settings.samples);
+    camera.SetSampler((SamplerType) settings.sampler);
+    camera.SetProgress(ProgressMode::Off);
+}
+
+static Camera MakeCamera(const RenderSettings& settings)
+{
+    Vector3 lookFrom(settings.lookFrom[0], settings.lookFrom[1], settings.lookFrom[2]);
+    Vector3 lookAt(settings.lookAt[0], settings.lookAt[1], settings.lookAt[2]);
+    Vector3 vup(settings.vup[0], settings.vup[1], settings.vup[2]);
+    double focus = settings.focusDist > 0 ? settings.focusDist : (lookAt - lookFrom).Length();
+    return Camera(lookFrom, lookAt, vup, settings.vfov, settings.aperture, focus, settings.nx, settings.ny);
+}
+
+static SuiteStages MeasureStages(const RenderSettings& settings, Objects& objects, const FrameBuffer& image)
+{
+    SuiteStages stages;
+    int nx = settings.nx, ny = settings.ny, samples = min(settings.samples, 4);
+    Camera camera = MakeCamera(settings);
+    size_t n = (size_t) nx * ny * samples;
+    vector<Ray> rays;
+    rays.reserve(n);
+    auto start = chrono::steady_clock::now();
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            for (int k = 0; k < samples; ++k)
+            {
+                SeedThreadRng((uint64_t) j * nx + i, k, 0);
+                rays.push_back(camera.GetRay((i + RandomDouble()) / nx, (j + RandomDouble()) / ny));
+            }
+        }
+    }
+    stages.camera = SecondsSince(start) * 1e9 / n;
+
+    vector<Hit> hits(n);
+    start = chrono::steady_clock::now();
+    for (size_t r = 0; r < n; ++r)
+    {
+        objects.Intersect(rays[r], 0, MAXFLOAT, hits[r]);
+    }
+    stages.intersect = SecondsSince(start) * 1e9 / n;
+
+    HitRecord hr;
+    start = chrono::steady_clock::now();
+    for (size_t r = 0; r < n; ++r)
+    {
+        if (hits[r].object < 0) continue;
+        hr.scatterInfos.clear();
+        objects.Shade(rays[r], hits[r], 0, hr);
+    }
+    stages.shade = SecondsSince(start) * 1e9 / n;
+
+    const char* path = "bench_suite.ppm";
+    CachedPPM ppm(nx, ny, path);
+    ppm.SetStreaming(0);
+    copy(image.Data(), image.Data() + (size_t) nx * ny, ppm.Buffer().Data());
+    start = chrono::steady_clock::now();
+    ppm.WriteToFile();
+    stages.output = SecondsSince(start) * 1000;
+    remove(path);
+    return stages;
+}
+
+/* False with error set if the scene cannot be built */
+static bool RunSuiteScene(const SuiteScene& suiteScene, const vector<int>& threadCounts, SuiteResult& result,
+                          string& error)
+{
+    result.scene = &suiteScene;
+    Scene scene;
+    suiteScene.make(scene);
+    RenderSettings settings = scene.Settings();
+    settings.nx = suiteScene.nx;
+    settings.ny = suiteScene.ny;
+    settings.samples = suiteScene.samples;
+
+    Objects objects;
+    if (!scene.Build(objects, error))
+    {
+        error = string(suiteScene.name) + ": " + error;
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    objects.Prepare();
+    result.prepareMs = SecondsSince(start) * 1000;
+    result.objects = objects.Size();
+
+    PathTracer tracer(settings.sunSky ? ColorSky : ColorSkyGradient);
+    CachedPPM ppm(settings.nx, settings.ny, nullptr);
+    for (int threads: threadCounts)
+    {
+        Camera camera = MakeCamera(settings);
+        SetUpCamera(camera, settings, tracer);
+        camera.SetThreads(threads);
+        ppm.Reset(nullptr);
+        start = chrono::steady_clock::now();
+        camera.Render(ppm, objects);
+        result.runs.push_back({threads, SecondsSince(start), camera.RaysTraced(), camera.SamplesTaken()});
+    }
+    result.stages = MeasureStages(settings, objects, ppm.Buffer());
+    return true;
+}
+
+static void PrintSuiteResult(const SuiteResult& result)
+{
+    const SuiteScene& scene = *result.scene;
+    const SuiteStages& st = result.stages;
+    printf("%s: %dx%d, %d spp, %d objects, prepare %.1f ms\n", scene.name, scene.nx, scene.ny, scene.samples,
+           result.objects, result.prepareMs);
+    printf("  first bounce replay, ns/ray: camera %.1f, intersect %.1f, shade %.1f (%.0f primary ray/s); "
+           "output %.1f ms\n", st.camera, st.intersect, st.shade, 1e9 / (st.camera + st.intersect), st.output);
+    // every sample starts with one camera ray, so samples are the primary rays of a run
+    printf("  %-8s %10s %14s %14s %9s\n", "threads", "ms", "ray/s", "primary ray/s", "speedup");
+    for (const SuiteRun& run: result.runs)
+    {
+        printf("  %-8d %10.1f %14.0f %14.0f %9.2f\n", run.threads, run.seconds * 1000, run.rays / run.seconds,
+               run.samples / run.seconds, result.runs[0].seconds / run.seconds);
+    }
+}
+
+static bool WriteSuiteJson(const char* path, const vector<SuiteResult>& results, string& error)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+    {
+        error = string(path) + ": cannot create";
+        return false;
+    }
+    const char* simd[] = {"scalar", "avx2", "avx512"};
+    time_t now = time(nullptr);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(f, "{\n  \"version\": 2,\n  \"date\": \"%s\",\n", date);
+    fprintf(f, "  \"build\": {\"compiler\": \"%s\", \"simd\": \"%s\", \"hardware_threads\": %u},\n", __VERSION__,
+            simd[(int) SphereKernel()], thread::hardware_concurrency());
+    fprintf(f, "  \"scenes\": [");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const SuiteResult& result = results[i];
+        const SuiteScene& scene = *result.scene;
+        const SuiteStages& st = result.stages;
+        fprintf(f, "%s\n    {\n", i ? "," : "");
+        fprintf(f, "      \"name\": \"%s\", \"width\": %d, \"height\": %d, \"samples\": %d, \"objects\": %d,\n",
+                scene.name, scene.nx, scene.ny, scene.samples, result.objects);
+        fprintf(f, "      \"prepare_ms\": %.3f,\n", result.prepareMs);
+        fprintf(f, "      \"replay\": {\"camera_ns\": %.2f, \"intersect_ns\": %.2f, \"shade_ns\": %.2f, "
+                   "\"primary_rays_per_second\": %.0f, \"output_ms\": %.3f},\n",
+                st.camera, st.intersect, st.shade, 1e9 / (st.camera + st.intersect), st.output);
+        fprintf(f, "      \"runs\": [");
+        for (size_t r = 0; r < result.runs.size(); ++r)
+        {
+            const SuiteRun& run = result.runs[r];
+            fprintf(f, "%s\n        {\"threads\": %d, \"seconds\": %.4f, \"rays\": %lld, \"samples\": %lld, "
+                       "\"rays_per_second\": %.0f, \"primary_rays_per_second\": %.0f, \"speedup\": %.3f}",
+                    r ? "," : "", run.threads, run.seconds, (long long) run.rays, (long long) run.samples,
+                    run.rays / run.seconds, run.samples / run.seconds, result.runs[0].seconds / run.seconds);
+        }
+        fprintf(f, "\n      ]\n    }");
+    }
+    fprintf(f, "\n  ]\n}\n");
+    if (fclose(f) != 0)
+    {
+        error = string(path) + ": write failed";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Renders the suite's scenes at a fixed size and sample count with every
+ * thread count: total rays (closest and any hit) and primary rays per
+ * second, and the speedup over the first thread count. Every sample
+ * starts with one camera ray, so the primary rays of a run are its
+ * samples. The cost of the stages of the first bounce is measured apart,
+ * replayed one stage at a time on one thread. The scenes are generated from fixed seeds, so runs of different
+ * builds trace the same rays.
+ */
+static int RunSuite(const char* jsonPath, const vector<int>& threadCounts, const char* only)
+{
+    vector<SuiteResult> results;
+    string error;
+    for (const SuiteScene& scene: SUITE_SCENES)
+    {
+        if (only && strcmp(only, scene.name) != 0) continue;
+        results.push_back(SuiteResult());
+        if (!RunSuiteScene(scene, threadCounts, results.back(), error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        PrintSuiteResult(results.back());
+    }
+    if (results.empty())
+    {
+        fprintf(stderr, "no scene named %s\n", only);
+        return 1;
+    }
+    if (jsonPath && !WriteSuiteJson(jsonPath, results, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static void RunMicroBenchmarks()
+{
+    BenchBVH();
+    BenchSphereKernels();
+    BenchPackets();
+    BenchWavefront();
+    BenchLightSampling();
+    BenchSamplers();
+    BenchMaterials();
+    BenchSceneStorage();
+    BenchSceneLoading();
+    BenchMeshLoading();
+    BenchCheckpoint();
+    BenchDistributed();
+    BenchOutputLatency();
+    BenchSequence();
+    BenchRng();
+    BenchImageWrite();
+}
+
+int main(int argc, char** argv)
+{
+    const char* jsonPath = nullptr;
+    const char* scene = nullptr;
+    vector<int> threadCounts;
+    bool micro = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+        else if (arg == "--scene" && i + 1 < argc) scene = argv[++i];
+        else if (arg == "--micro") micro = true;
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            for (const char* p = argv[++i]; *p; ++p)
+            {
+                if (isdigit((unsigned char) *p) && (p == argv[i] || !isdigit((unsigned char) p[-1])))
+                {
+                    threadCounts.push_back(atoi(p));
+                }
+            }
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--json results.json] [--threads 1,2,4] [--scene name] [--micro]\n"
+                            "  runs the benchmark suite, --micro the component benchmarks instead\n", argv[0]);
+            return 1;
+        }
+    }
+    if (micro)
+    {
+        RunMicroBenchmarks();
+        return 0;
+    }
+    if (threadCounts.empty())
+    {
+        // powers of two up to every hardware thread
+        int hardware = max(1, (int) thread::hardware_concurrency());
+        for (int t = 1; t < hardware; t *= 2) threadCounts.push_back(t);
+        threadCounts.push_back(hardware);
+    }
+    return RunSuite(jsonPath, threadCounts, scene);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ * Fixed size lock-free queue for any number of producers and consumers
+ * (Vyukov's array queue). Every slot carries a sequence number that says
+ * whether it is free for the producer of a position or holds the item of
+ * the consumer of that position, so Push and Pop only claim a position
+ * with one compare-exchange and never wait. They fail instead when the
+ * queue is full or empty.
+ */
+template <class T>
+class BoundedQueue
+{
+public:
+    /* capacity is rounded up to a power of two */
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool Push(const T& item)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true)
+        {
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+            if (difference == 0)
+            {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = item;
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true)
+        {
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+            if (difference == 0)
+            {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+        item = slot->item;
+        // free for the producer of the position one lap later
+        slot->sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    std::atomic<size_t> head{0};    // next position to push
+    char padding[64];               // keep producers and consumers off one cache line
+    std::atomic<size_t> tail{0};    // next position to pop
+};
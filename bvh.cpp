@@ -0,0 +1,148 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+const int BIN_COUNT = 16;
+// below this depth splits fall back to the median so the traversal stack can't overflow
+const int SAH_DEPTH = 32;
+// cost of visiting a node relative to intersecting a primitive
+const double TRAVERSAL_COST = 0.5;
+
+struct Bin
+{
+    AABB box;
+    int count = 0;
+};
+}
+
+void BVH::Build(const std::vector<AABB>& bounds)
+{
+    Clear();
+    if (bounds.empty()) return;
+    vector<Vector3> centroids(bounds.size());
+    primIndices.resize(bounds.size());
+    for (int i = 0; i < (int) bounds.size(); ++i)
+    {
+        centroids[i] = bounds[i].Centroid();
+        primIndices[i] = i;
+    }
+    nodes.reserve(2 * bounds.size());
+    BuildNode(bounds, centroids, 0, (int) bounds.size(), 0);
+    // leaves hold several primitives, most of the reserved nodes went unused
+    nodes.shrink_to_fit();
+    builtArea = NodeArea();
+}
+
+double BVH::NodeArea() const
+{
+    double area = 0;
+    for (const BVHNode& node: nodes)
+    {
+        area += node.box.SurfaceArea();
+    }
+    return area;
+}
+
+int BVH::BuildNode(const std::vector<AABB>& bounds, std::vector<Vector3>& centroids,
+                   int begin, int end, int depth)
+{
+    int index = (int) nodes.size();
+    nodes.push_back(BVHNode());
+    AABB box, centroidBox;
+    for (int i = begin; i < end; ++i)
+    {
+        box.Extend(bounds[primIndices[i]]);
+        centroidBox.Extend(centroids[primIndices[i]]);
+    }
+    nodes[index].box = box;
+
+    int n = end - begin;
+    int axis = centroidBox.LongestAxis();
+    double cmin = centroidBox.pMin.e[axis];
+    double extent = centroidBox.pMax.e[axis] - cmin;
+    if (n <= 1 || extent <= 0)
+    {
+        // all centroids coincide, nothing to split on
+        nodes[index].offset = begin;
+        nodes[index].count = n;
+        return index;
+    }
+
+    int maxLeafSize = max(4, leafWidth);
+    // intersection cost of a group of primitives, in units of one intersection test
+    auto groupCost = [&](int count) { return (double) ((count + leafWidth - 1) / leafWidth); };
+    int mid = begin;
+    if (depth < SAH_DEPTH)
+    {
+        Bin bins[BIN_COUNT];
+        auto binOf = [&](int prim) {
+            int b = (int) (BIN_COUNT * (centroids[prim].e[axis] - cmin) / extent);
+            return b < BIN_COUNT ? b : BIN_COUNT - 1;
+        };
+        for (int i = begin; i < end; ++i)
+        {
+            Bin& bin = bins[binOf(primIndices[i])];
+            bin.box.Extend(bounds[primIndices[i]]);
+            ++bin.count;
+        }
+
+        // sweep from the right to get the cost of each right half
+        double rightCost[BIN_COUNT];
+        AABB right;
+        int rightCount = 0;
+        for (int b = BIN_COUNT - 1; b > 0; --b)
+        {
+            right.Extend(bins[b].box);
+            rightCount += bins[b].count;
+            rightCost[b] = rightCount ? right.SurfaceArea() * groupCost(rightCount) : 0;
+        }
+        AABB left;
+        int leftCount = 0, bestSplit = -1;
+        double bestCost = INFINITY;
+        for (int b = 1; b < BIN_COUNT; ++b)
+        {
+            left.Extend(bins[b - 1].box);
+            leftCount += bins[b - 1].count;
+            double cost = (leftCount ? left.SurfaceArea() * groupCost(leftCount) : 0) + rightCost[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+        bestCost = TRAVERSAL_COST + bestCost / box.SurfaceArea();
+        if (n <= maxLeafSize && groupCost(n) <= bestCost)
+        {
+            nodes[index].offset = begin;
+            nodes[index].count = n;
+            return index;
+        }
+        mid = (int) (partition(primIndices.begin() + begin, primIndices.begin() + end,
+                               [&](int prim) { return binOf(prim) < bestSplit; })
+                     - primIndices.begin());
+    }
+    else if (n <= maxLeafSize)
+    {
+        nodes[index].offset = begin;
+        nodes[index].count = n;
+        return index;
+    }
+    if (mid == begin || mid == end)
+    {
+        mid = begin + n / 2;
+        nth_element(primIndices.begin() + begin, primIndices.begin() + mid,
+                    primIndices.begin() + end, [&](int a, int b) {
+                    return centroids[a].e[axis] < centroids[b].e[axis];
+                });
+    }
+
+    BuildNode(bounds, centroids, begin, mid, depth + 1);
+    int second = BuildNode(bounds, centroids, mid, end, depth + 1);
+    nodes[index].offset = second;
+    nodes[index].count = 0;
+    return index;
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "raypacket.h"
+
+#include <algorithm>
+
+/*
+ * A node of the flattened BVH. Nodes are stored depth-first, so the
+ * first child of an interior node always directly follows it.
+ */
+struct BVHNode
+{
+    AABB box;
+    int offset;     // leaf: index of the first primitive, interior: index of the second child
+    int count;      // number of primitives, 0 for interior nodes
+};
+
+/**
+ * Bounding volume hierarchy over a set of primitive bounds,
+ * built with binned SAH and stored as a flat node array.
+ */
+class BVH
+{
+public:
+    static const int MAX_DEPTH = 64;
+
+    /* Build the hierarchy over the given bounds. Primitive i is bounds[i]. */
+    void Build(const std::vector<AABB>& bounds);
+
+    /*
+     * Number of primitives the leaf intersection tests at once (SIMD width).
+     * Leaves get up to max(4, width) primitives and the SAH costs a
+     * group of width primitives like a single one.
+     */
+    void SetLeafWidth(int width) { leafWidth = width > 0 ? width : 1; }
+
+    /*
+     * Fit the nodes to primitives that moved, keeping the tree: leaves take
+     * the union of boundsOf(prim) of their primitives and interior nodes the
+     * union of their children. Returns the summed node surface area over
+     * the one after Build, which grows as the tree fits the scene worse.
+     */
+    template <class F>
+    double Refit(F&& boundsOf);
+
+    void Clear() { nodes.clear(); primIndices.clear(); builtArea = 0; }
+    bool Empty() const { return nodes.empty(); }
+    int NodeCount() const { return (int) nodes.size(); }
+    size_t Bytes() const { return nodes.capacity() * sizeof(BVHNode) + primIndices.capacity() * sizeof(int); }
+
+    /*
+     * Visit the leaves the ray passes through, nearest first.
+     * intersect(prim, maxT) tests one primitive and, on a closer hit,
+     * shrinks maxT and returns true. Subtrees behind the closest hit are skipped.
+     */
+    template <class F>
+    bool Traverse(const Ray& r, double minT, double maxT, F&& intersect) const;
+
+    /*
+     * Same as Traverse, one call per leaf: intersect(first, count, maxT) tests
+     * the primitives PrimIndices()[first, first + count).
+     */
+    template <class F>
+    bool TraverseLeaves(const Ray& r, double minT, double maxT, F&& intersect) const;
+
+    /*
+     * Any-hit query: visit the leaves the ray passes through, in no
+     * particular order, until anyHit(first, count) reports a hit in one.
+     */
+    template <class F>
+    bool TraverseAny(const Ray& r, double minT, double maxT, F&& anyHit) const;
+
+    /*
+     * Visit the leaves a packet of prepared rays passes through. Whole
+     * subtrees are culled with the packet bounds, otherwise the rays are
+     * tested from the first one that hit the parent node on.
+     * intersect(first, count, ray) tests one ray against a leaf and
+     * shrinks packet.tMax[ray] on a closer hit.
+     */
+    template <class F>
+    void TraversePacket(RayPacket& packet, double minT, F&& intersect) const;
+
+    /* Primitives in leaf order */
+    const std::vector<int>& PrimIndices() const { return primIndices; }
+protected:
+    int BuildNode(const std::vector<AABB>& bounds, std::vector<Vector3>& centroids,
+                  int begin, int end, int depth);
+    double NodeArea() const;
+    std::vector<BVHNode> nodes;
+    std::vector<int> primIndices;
+    int leafWidth = 1;
+    double builtArea = 0;
+};
+
+template <class F>
+double BVH::Refit(F&& boundsOf)
+{
+    // children come after their parent, so a backwards sweep sees them first
+    for (int i = (int) nodes.size() - 1; i >= 0; --i)
+    {
+        BVHNode& node = nodes[i];
+        AABB box;
+        if (node.count > 0)
+        {
+            for (int p = node.offset; p < node.offset + node.count; ++p)
+            {
+                box.Extend(boundsOf(primIndices[p]));
+            }
+        }
+        else
+        {
+            box.Extend(nodes[i + 1].box);
+            box.Extend(nodes[node.offset].box);
+        }
+        node.box = box;
+    }
+    return builtArea > 0 ? NodeArea() / builtArea : 1;
+}
+
+template <class F>
+bool BVH::Traverse(const Ray& r, double minT, double maxT, F&& intersect) const
+{
+    return TraverseLeaves(r, minT, maxT, [&](int first, int count, double& tMax) {
+        bool hit = false;
+        for (int i = first; i < first + count; ++i)
+        {
+            if (intersect(primIndices[i], tMax))
+            {
+                hit = true;
+            }
+        }
+        return hit;
+    });
+}
+
+template <class F>
+bool BVH::TraverseLeaves(const Ray& r, double minT, double maxT, F&& intersect) const
+{
+    if (nodes.empty()) return false;
+    Vector3 origin = r.Origin(), dir = r.Direction();
+    Vector3 invDir{1 / dir.e[0], 1 / dir.e[1], 1 / dir.e[2]};
+
+    struct Entry { int node; double t; };
+    Entry stack[MAX_DEPTH];
+    int top = 0;
+    bool hit = false;
+    double t;
+    if (!nodes[0].box.IsHit(origin, invDir, minT, maxT, t)) return false;
+    stack[top++] = {0, t};
+
+    while (top > 0)
+    {
+        Entry e = stack[--top];
+        // a closer hit was found after this node was pushed
+        if (e.t > maxT) continue;
+        const BVHNode* node = &nodes[e.node];
+        while (node->count == 0)
+        {
+            int first = e.node + 1, second = node->offset;
+            double tFirst, tSecond;
+            bool hitFirst = nodes[first].box.IsHit(origin, invDir, minT, maxT, tFirst);
+            bool hitSecond = nodes[second].box.IsHit(origin, invDir, minT, maxT, tSecond);
+            if (hitFirst && hitSecond)
+            {
+                if (tSecond < tFirst)
+                {
+                    std::swap(first, second);
+                    std::swap(tFirst, tSecond);
+                }
+                stack[top++] = {second, tSecond};
+            }
+            else if (hitSecond)
+            {
+                first = second;
+            }
+            else if (!hitFirst)
+            {
+                node = nullptr;
+                break;
+            }
+            e.node = first;
+            node = &nodes[first];
+        }
+        if (!node) continue;
+        if (intersect(node->offset, node->count, maxT))
+        {
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+template <class F>
+bool BVH::TraverseAny(const Ray& r, double minT, double maxT, F&& anyHit) const
+{
+    if (nodes.empty()) return false;
+    Vector3 origin = r.Origin(), dir = r.Direction();
+    Vector3 invDir{1 / dir.e[0], 1 / dir.e[1], 1 / dir.e[2]};
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    double t;
+    while (top > 0)
+    {
+        int index = stack[--top];
+        const BVHNode& node = nodes[index];
+        if (!node.box.IsHit(origin, invDir, minT, maxT, t)) continue;
+        if (node.count > 0)
+        {
+            if (anyHit(node.offset, node.count)) return true;
+            continue;
+        }
+        stack[top++] = node.offset;
+        stack[top++] = index + 1;
+    }
+    return false;
+}
+
+template <class F>
+void BVH::TraversePacket(RayPacket& packet, double minT, F&& intersect) const
+{
+    if (nodes.empty() || packet.size == 0) return;
+    // the furthest any ray may still go
+    double maxT = *std::max_element(packet.tMax, packet.tMax + packet.size);
+
+    struct Entry { int node; int ray; };
+    Entry stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = {0, 0};
+    while (top > 0)
+    {
+        Entry e = stack[--top];
+        const BVHNode& node = nodes[e.node];
+        if (packet.coherent && packet.Misses(node.box, minT, maxT)) continue;
+        // rays before the first one that hits this node miss its children too
+        int ray = e.ray;
+        double t;
+        while (ray < packet.size &&
+               !node.box.IsHit(packet.rays[ray].Origin(), packet.invDir[ray], minT, packet.tMax[ray], t))
+        {
+            ++ray;
+        }
+        if (ray == packet.size) continue;
+
+        if (node.count > 0)
+        {
+            intersect(node.offset, node.count, ray);
+            for (int i = ray + 1; i < packet.size; ++i)
+            {
+                if (node.box.IsHit(packet.rays[i].Origin(), packet.invDir[i], minT, packet.tMax[i], t))
+                {
+                    intersect(node.offset, node.count, i);
+                }
+            }
+            maxT = *std::max_element(packet.tMax, packet.tMax + packet.size);
+            continue;
+        }
+
+        // visit the child nearer along the first active ray first
+        int first = e.node + 1, second = node.offset;
+        Vector3 toSecond = nodes[second].box.Centroid() - nodes[first].box.Centroid();
+        if (toSecond.Dot(packet.rays[ray].Direction()) < 0)
+        {
+            std::swap(first, second);
+        }
+        stack[top++] = {second, ray};
+        stack[top++] = {first, ray};
+    }
+}
@@ -0,0 +1,223 @@
+#include "checkpoint.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+const char MAGIC[8] = {'R', 'T', 'C', 'K', 'P', 'T', 0, 0};
+const uint32_t VERSION = 2;
+
+enum Flags : uint32_t
+{
+    HAS_COUNTS = 1,         // per pixel sample counts, otherwise all pixels have uniformCount
+    HAS_VARIANCE = 2,
+    HAS_CONVERGED = 4
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    CheckpointInfo info;
+    int32_t passes;
+    float uniformCount;
+    int64_t samples;
+    double elapsed;
+};
+
+bool WriteAll(int fd, const void* data, size_t size)
+{
+    const char* p = (const char*) data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+}
+
+bool SaveCheckpoint(const char* path, const Checkpoint& checkpoint, string& error)
+{
+    size_t n = checkpoint.pixels.size();
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.info = checkpoint.info;
+    header.passes = checkpoint.passes;
+    header.samples = checkpoint.samples;
+    header.elapsed = checkpoint.elapsed;
+    header.uniformCount = n ? checkpoint.pixels[0].n : 0;
+    for (const Pixel& p: checkpoint.pixels)
+    {
+        if (p.n != header.uniformCount)
+        {
+            header.flags |= HAS_COUNTS;
+            break;
+        }
+    }
+    if (!checkpoint.luminanceSq.empty()) header.flags |= HAS_VARIANCE;
+    if (!checkpoint.converged.empty()) header.flags |= HAS_CONVERGED;
+
+    // colors and counts as separate planes, the counts are often left out
+    vector<float> plane(n * 3);
+    for (size_t i = 0; i < n; ++i)
+    {
+        plane[3 * i] = checkpoint.pixels[i].r;
+        plane[3 * i + 1] = checkpoint.pixels[i].g;
+        plane[3 * i + 2] = checkpoint.pixels[i].b;
+    }
+    string temporary = string(path) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        error = temporary + ": cannot create";
+        return false;
+    }
+    bool ok = WriteAll(fd, &header, sizeof(header)) && WriteAll(fd, plane.data(), n * 3 * sizeof(float));
+    if (ok && (header.flags & HAS_COUNTS))
+    {
+        for (size_t i = 0; i < n; ++i) plane[i] = checkpoint.pixels[i].n;
+        ok = WriteAll(fd, plane.data(), n * sizeof(float));
+    }
+    if (ok && (header.flags & HAS_VARIANCE))
+    {
+        ok = WriteAll(fd, checkpoint.luminanceSq.data(), n * sizeof(float));
+    }
+    if (ok && (header.flags & HAS_CONVERGED))
+    {
+        ok = WriteAll(fd, checkpoint.converged.data(), n);
+    }
+    // on disk before it replaces the last good checkpoint
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path) != 0)
+    {
+        unlink(temporary.c_str());
+        error = string(path) + ": write failed";
+        return false;
+    }
+    return true;
+}
+
+bool LoadCheckpoint(const char* path, Checkpoint& checkpoint, string& error)
+{
+    ifstream fin(path, ios::binary);
+    if (!fin)
+    {
+        error = string(path) + ": cannot open";
+        return false;
+    }
+    FileHeader header;
+    if (!fin.read((char*) &header, sizeof(header)) || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.version != VERSION || header.info.nx <= 0 || header.info.ny <= 0)
+    {
+        error = string(path) + ": not a checkpoint of this version";
+        return false;
+    }
+    size_t n = (size_t) header.info.nx * header.info.ny;
+    checkpoint.info = header.info;
+    checkpoint.passes = header.passes;
+    checkpoint.samples = header.samples;
+    checkpoint.elapsed = header.elapsed;
+
+    vector<float> plane(n * 3);
+    bool ok = (bool) fin.read((char*) plane.data(), n * 3 * sizeof(float));
+    checkpoint.pixels.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        checkpoint.pixels[i] = {plane[3 * i], plane[3 * i + 1], plane[3 * i + 2], header.uniformCount};
+    }
+    if (ok && (header.flags & HAS_COUNTS))
+    {
+        ok = (bool) fin.read((char*) plane.data(), n * sizeof(float));
+        for (size_t i = 0; i < n; ++i) checkpoint.pixels[i].n = plane[i];
+    }
+    checkpoint.luminanceSq.clear();
+    if (ok && (header.flags & HAS_VARIANCE))
+    {
+        checkpoint.luminanceSq.resize(n);
+        ok = (bool) fin.read((char*) checkpoint.luminanceSq.data(), n * sizeof(float));
+    }
+    checkpoint.converged.clear();
+    if (ok && (header.flags & HAS_CONVERGED))
+    {
+        checkpoint.converged.resize(n);
+        ok = (bool) fin.read((char*) checkpoint.converged.data(), n);
+    }
+    if (!ok)
+    {
+        error = string(path) + ": truncated";
+        return false;
+    }
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(const string& path) : path(path)
+{
+    thread = std::thread(&CheckpointWriter::Loop, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+void CheckpointWriter::Submit(Checkpoint& checkpoint)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        swap(pending, checkpoint);
+        hasPending = true;
+    }
+    changed.notify_all();
+}
+
+void CheckpointWriter::Wait()
+{
+    unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return !hasPending && !writing; });
+}
+
+void CheckpointWriter::Remove()
+{
+    Wait();
+    unlink(path.c_str());
+}
+
+void CheckpointWriter::Loop()
+{
+    Checkpoint current;
+    unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        changed.wait(lock, [this]() { return hasPending || stopping; });
+        // a pending checkpoint is still written when stopping
+        if (!hasPending) return;
+        swap(current, pending);
+        hasPending = false;
+        writing = true;
+        lock.unlock();
+        string error;
+        if (!SaveCheckpoint(path.c_str(), current, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+        }
+        lock.lock();
+        writing = false;
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "stdafx.h"
+#include "framebuffer.h"
+
+/*
+ * The settings that decide a render's samples. A checkpoint only resumes a
+ * render with the same ones: the samplers number the samples of a pixel
+ * from its sample count, so the counts in the frame buffer together with
+ * these are the whole random state of a render. What the samples see, the
+ * scene, camera and tracer, the camera does not know; the caller sums it
+ * up in the fingerprint.
+ */
+struct CheckpointInfo
+{
+    int32_t nx, ny;
+    int32_t frame;
+    int32_t sampler;
+    int32_t samples;                // aa samples per pixel
+    int32_t passSamples;
+    double adaptiveThreshold;
+    int32_t adaptiveMinSamples, adaptiveMaxSamples;
+    uint64_t fingerprint;           // of the scene and the render settings, given by the caller
+};
+
+inline bool operator==(const CheckpointInfo& a, const CheckpointInfo& b)
+{
+    return a.nx == b.nx && a.ny == b.ny && a.frame == b.frame && a.sampler == b.sampler &&
+           a.samples == b.samples && a.passSamples == b.passSamples && a.adaptiveThreshold == b.adaptiveThreshold &&
+           a.adaptiveMinSamples == b.adaptiveMinSamples && a.adaptiveMaxSamples == b.adaptiveMaxSamples &&
+           a.fingerprint == b.fingerprint;
+}
+
+/*
+ * A render stopped between two passes: the accumulation buffer, and for
+ * adaptive sampling the squared luminances and converged pixels. Sample
+ * counts are only stored when they differ between pixels.
+ */
+struct Checkpoint
+{
+    CheckpointInfo info;
+    int32_t passes = 0;             // passes done
+    int64_t samples = 0;            // samples taken
+    double elapsed = 0;             // seconds spent rendering
+    std::vector<Pixel> pixels;
+    std::vector<float> luminanceSq;
+    std::vector<unsigned char> converged;
+};
+
+/*
+ * Write to a temporary file renamed over path once it is complete, so a
+ * process killed while writing leaves the previous checkpoint intact.
+ */
+bool SaveCheckpoint(const char* path, const Checkpoint& checkpoint, std::string& error);
+bool LoadCheckpoint(const char* path, Checkpoint& checkpoint, std::string& error);
+
+/**
+ * Writes checkpoints on a thread of its own, the render threads only copy
+ * the buffers. If a checkpoint is submitted while the last one is still
+ * being written, it waits and is replaced by any newer one.
+ */
+class CheckpointWriter
+{
+public:
+    explicit CheckpointWriter(const std::string& path);
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    /* Writes what was submitted before returning */
+    ~CheckpointWriter();
+
+    /* Take the buffers of checkpoint for writing, leaves it with the previous buffers to reuse */
+    void Submit(Checkpoint& checkpoint);
+
+    /* Wait until everything submitted is written */
+    void Wait();
+
+    /* Remove the checkpoint file, for a render that is done */
+    void Remove();
+private:
+    void Loop();
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable changed;
+    Checkpoint pending;
+    bool hasPending = false;
+    bool writing = false;
+    bool stopping = false;
+    std::thread thread;
+};
@@ -1,15 +1,65 @@
 #include "common.h"
+#include "bvh.h"
+#include "alloc.h"
+#include "rng.h"
+#include "threadpool.h"
+#include "ppm.h"
+#include "framebuffer.h"
+#include "object.h"
+#include "material.h"
+#include "spheresoa.h"
+#include "raypacket.h"
+#include "checkpoint.h"
+#include "boundedqueue.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unordered_map>
+#include <unistd.h>
 
 using namespace std;
 
-Vector3 RandomUnitVector()
+Vector3 SampleSphere(double u1, double u2)
+{
+    double z = 1 - 2 * u1;
+    double r = sqrt(max(0.0, 1 - z * z));
+    double phi = 2 * M_PI * u2;
+    return {r * cos(phi), r * sin(phi), z};
+}
+
+Vector3 SampleDisk(double u1, double u2)
 {
-    Vector3 p;
-    do
+    // squares around the center go to circles, Shirley and Chiu
+    double a = 2 * u1 - 1, b = 2 * u2 - 1;
+    if (a == 0 && b == 0) return {0, 0, 0};
+    double r, phi;
+    if (fabs(a) > fabs(b))
     {
-        p = 2.f * Vector3((double) drand48(), (double) drand48(), (double) drand48()) - Vector3(1, 1, 1);
-    } while (p.Length() >= 1);
-    return p;
+        r = a;
+        phi = M_PI / 4 * (b / a);
+    }
+    else
+    {
+        r = b;
+        phi = M_PI / 2 - M_PI / 4 * (a / b);
+    }
+    return {r * cos(phi), r * sin(phi), 0};
+}
+
+MaterialRecord Material::Record() const
+{
+    return {MaterialKind::Other, {0, 0, 0}, 0, this};
+}
+
+Color Material::Emitted() const
+{
+    return {0, 0, 0};
+}
+
+void Material::Evaluate(const Ray& r, const HitRecord& hr, const Vector3& dir, Color& f, double& pdf) const
+{
+    f = {0, 0, 0};
+    pdf = 0;
 }
 
 Vector3::Vector3(double a, double b, double c)
@@ -19,30 +69,347 @@ Vector3::Vector3(double a, double b, double c)
     e[2] = c;
 }
 
+AABB::AABB() : pMin(INFINITY, INFINITY, INFINITY), pMax(-INFINITY, -INFINITY, -INFINITY)
+{
+}
+
+void AABB::Extend(const Vector3& p)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        pMin.e[i] = p.e[i] < pMin.e[i] ? p.e[i] : pMin.e[i];
+        pMax.e[i] = p.e[i] > pMax.e[i] ? p.e[i] : pMax.e[i];
+    }
+}
+
+void AABB::Extend(const AABB& box)
+{
+    Extend(box.pMin);
+    Extend(box.pMax);
+}
+
+double AABB::SurfaceArea() const
+{
+    Vector3 d = pMax - pMin;
+    if (d.e[0] < 0) return 0;
+    return 2 * (d.e[0] * d.e[1] + d.e[1] * d.e[2] + d.e[2] * d.e[0]);
+}
+
+int AABB::LongestAxis() const
+{
+    Vector3 d = pMax - pMin;
+    if (d.e[0] > d.e[1] && d.e[0] > d.e[2]) return 0;
+    return d.e[1] > d.e[2] ? 1 : 2;
+}
+
+Objects::Objects() : arena(new Arena), bvh(new BVH), spheres(new SphereSoA)
+{
+}
+
+Objects::~Objects()
+{
+    Release();
+    delete arena;
+    delete bvh;
+    delete spheres;
+}
+
+void* Objects::ArenaAllocate(size_t size, size_t align)
+{
+    return arena->Allocate(size, align);
+}
+
+int Objects::StoreMaterial(const Material* m)
+{
+    sceneMaterials.push_back(m);
+    return (int) sceneMaterials.size() - 1;
+}
+
+int Objects::AddSphere(const Vector3& center, double radius, int material)
+{
+    objects.push_back(arena->New<Sphere>(center, radius, *sceneMaterials[material]));
+    bvhDirty = true;
+    allSpheres = false;
+    return (int) objects.size() - 1;
+}
+
+int Objects::AddMesh(TriangleMesh&& mesh, int material)
+{
+    auto* stored = new TriangleMesh(std::move(mesh));
+    meshes.push_back(stored);
+    int first = (int) objects.size();
+    Reserve(stored->Triangles());
+    for (int i = 0; i < stored->Triangles(); ++i)
+    {
+        objects.push_back(arena->New<Triangle>(*stored, i, *sceneMaterials[material]));
+    }
+    bvhDirty = true;
+    allSpheres = false;
+    return first;
+}
+
+void Objects::Release()
+{
+    for (auto& h: heapObjects) h.destroy(h.object);
+    heapObjects.clear();
+    for (auto* m: meshes) delete m;
+    meshes.clear();
+    objects.clear();
+    sceneMaterials.clear();
+    // the scene's own spheres and materials go all at once
+    arena->Reset();
+    bvhDirty = true;
+    allSpheres = false;
+}
+
+SceneMemory Objects::Memory() const
+{
+    SceneMemory m;
+    m.arenaUsed = arena->Used();
+    m.arenaReserved = arena->Reserved();
+    m.tables = (objects.capacity() + sceneMaterials.capacity() + meshes.capacity()) * sizeof(void*) +
+               heapObjects.capacity() * sizeof(HeapObject) + materials.capacity() * sizeof(MaterialRecord) +
+               (materialIndex.capacity() + lights.capacity()) * sizeof(int);
+    m.bvh = bvh->Bytes();
+    m.spheres = spheres->Bytes();
+    m.meshes = 0;
+    for (auto* mesh: meshes) m.meshes += mesh->Bytes();
+    m.heapObjects = (int) heapObjects.size();
+    return m;
+}
+
+void SceneMemory::Print() const
+{
+    const double mb = 1024 * 1024;
+    printf("scene memory: %.1f MB\n", Total() / mb);
+    printf("  arena    %10.1f MB (%.1f MB used)\n", arenaReserved / mb, arenaUsed / mb);
+    printf("  tables   %10.1f MB\n", tables / mb);
+    printf("  bvh      %10.1f MB\n", bvh / mb);
+    printf("  spheres  %10.1f MB\n", spheres / mb);
+    if (meshes > 0)
+    {
+        printf("  meshes   %10.1f MB\n", meshes / mb);
+    }
+    if (heapObjects > 0)
+    {
+        printf("  plus %d objects on the heap\n", heapObjects);
+    }
+}
+
+namespace
+{
+// a refit tree only gets worse, once its node area has grown this much a new one pays off
+const double REBUILD_GROWTH = 2;
+}
+
+void Objects::MoveSphere(int object, const Vector3& center)
+{
+    auto* sphere = dynamic_cast<Sphere*>(objects[object]);
+    assert(sphere);
+    sphere->SetCenter(center);
+    moved.push_back(object);
+    refitDirty = true;
+}
+
+void Objects::Prepare()
+{
+    if (!bvhDirty.load(memory_order_acquire) && !refitDirty.load(memory_order_acquire)) return;
+    lock_guard<mutex> lock(bvhMutex);
+    if (!bvhDirty.load(memory_order_relaxed))
+    {
+        if (!refitDirty.load(memory_order_relaxed)) return;
+        double growth = bvh->Refit([this](int prim) { return objects[prim]->BoundingBox(); });
+        for (int object: moved)
+        {
+            spheres->Move(object, static_cast<Sphere*>(objects[object])->Center());
+        }
+        moved.clear();
+        if (growth < REBUILD_GROWTH)
+        {
+            refitDirty.store(false, memory_order_release);
+            return;
+        }
+    }
+    vector<AABB> bounds;
+    bounds.reserve(objects.size());
+    for (auto* o: objects)
+    {
+        bounds.push_back(o->BoundingBox());
+    }
+    // leaves that fill a whole register cost about as much as a single sphere
+    bvh->SetLeafWidth(SphereKernelWidth());
+    bvh->Build(bounds);
+    allSpheres = spheres->Build(objects, bvh->PrimIndices());
+
+    materials.clear();
+    materialIndex.resize(objects.size());
+    unordered_map<const Material*, int> known;
+    lights.clear();
+    for (int i = 0; i < (int) objects.size(); ++i)
+    {
+        const Material* m = &objects[i]->material;
+        auto it = known.find(m);
+        if (it == known.end())
+        {
+            it = known.emplace(m, (int) materials.size()).first;
+            materials.push_back(m->Record());
+        }
+        materialIndex[i] = it->second;
+        if (!IsBlack(EmittedBy(materials[it->second])) && dynamic_cast<Sphere*>(objects[i]))
+        {
+            lights.push_back(i);
+        }
+    }
+    moved.clear();
+    refitDirty.store(false, memory_order_relaxed);
+    bvhDirty.store(false, memory_order_release);
+}
+
 bool Objects::IsHit(const Ray &r, double minT, double maxT, HitRecord &hitRec)
 {
-    bool hit = false;
-    double tempt = maxT;
-    int lastI = -1 ;
-    for (int i = 0; i < objects.size(); ++i)
+    Hit hit;
+    if (!Intersect(r, minT, maxT, hit)) return false;
+    Shade(r, hit, minT, hitRec);
+    return true;
+}
+
+bool Objects::Occluded(const Ray& r, double minT, double maxT)
+{
+    ++ThreadRayCount();
+    if (!useBvh)
+    {
+        for (auto* o: objects)
+        {
+            if (o->Occluded(r, minT, maxT)) return true;
+        }
+        return false;
+    }
+    Prepare();
+    return bvh->TraverseAny(r, minT, maxT, [&](int first, int count) {
+        double tMax = maxT;
+        if (spheres->Intersect(r, first, count, minT, tMax) >= 0) return true;
+        if (allSpheres) return false;
+        for (int i = first; i < first + count; ++i)
+        {
+            if (std::isnan(spheres->cx[i]) && objects[spheres->ObjectAt(i)]->Occluded(r, minT, maxT))
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+bool Objects::Intersect(const Ray& r, double minT, double maxT, Hit& hit)
+{
+    ++ThreadRayCount();
+    hit = {maxT, -1};
+    // the material table is needed to shade the hit even without the BVH
+    Prepare();
+    if (useBvh)
+    {
+        bvh->TraverseLeaves(r, minT, maxT, [&](int first, int count, double& tMax) {
+            int o = IntersectLeaf(r, first, count, minT, tMax);
+            if (o < 0) return false;
+            hit = {tMax, o};
+            return true;
+        });
+    }
+    else
     {
-        if (objects[i]->IsHit(r, minT, tempt, hitRec))
+        HitRecord hitRec;
+        for (int i = 0; i < objects.size(); ++i)
         {
-            hit = true;
-            tempt = hitRec.t;
-            lastI = i;
+            if (objects[i]->IsHit(r, minT, hit.t, hitRec))
+            {
+                hit = {hitRec.t, i};
+            }
         }
     }
-    if (lastI > -1)
+    return hit.object >= 0;
+}
+
+int Objects::IntersectLeaf(const Ray& r, int first, int count, double minT, double& tMax)
+{
+    int slot = spheres->Intersect(r, first, count, minT, tMax);
+    int closest = slot >= 0 ? spheres->ObjectAt(slot) : -1;
+    if (!allSpheres)
     {
-        objects[lastI]->material.Scatter(r, hitRec);
+        HitRecord hitRec;
+        for (int i = first; i < first + count; ++i)
+        {
+            int o = spheres->ObjectAt(i);
+            if (std::isnan(spheres->cx[i]) && objects[o]->IsHit(r, minT, tMax, hitRec))
+            {
+                tMax = hitRec.t;
+                closest = o;
+            }
+        }
     }
-    return hit;
+    return closest;
+}
+
+void Objects::IsHit(RayPacket& packet, double minT)
+{
+    if (!useBvh)
+    {
+        Hit hit;
+        for (int ray = 0; ray < packet.size; ++ray)
+        {
+            if (Intersect(packet.rays[ray], minT, packet.tMax[ray], hit))
+            {
+                packet.tMax[ray] = hit.t;
+                packet.object[ray] = hit.object;
+            }
+        }
+        return;
+    }
+    ThreadRayCount() += packet.size;
+    Prepare();
+    bvh->TraversePacket(packet, minT, [&](int first, int count, int ray) {
+        int o = IntersectLeaf(packet.rays[ray], first, count, minT, packet.tMax[ray]);
+        if (o >= 0)
+        {
+            packet.object[ray] = o;
+        }
+    });
+}
+
+void Objects::Surface(const Ray& r, const Hit& hit, double minT, HitRecord& hitRec)
+{
+    Object* o = objects[hit.object];
+    auto* sphere = allSpheres ? static_cast<Sphere*>(o) : dynamic_cast<Sphere*>(o);
+    if (sphere)
+    {
+        sphere->FillHit(r, hit.t, hitRec);
+    }
+    else
+    {
+        // the closest root past minT is the one Intersect found
+        o->IsHit(r, minT, nextafter(hit.t, INFINITY), hitRec);
+    }
+}
+
+void Objects::Shade(const Ray& r, const Hit& hit, double minT, HitRecord& hitRec)
+{
+    Surface(r, hit, minT, hitRec);
+    ScatterBy(MaterialAt(hit.object), r, hitRec);
 }
 
 Camera::Camera(const Vector3& lookFrom, const Vector3& lookAt,
          const Vector3& vup, float vfov, float aperture, float focusDist,
          int nx, int ny) : nx(nx), ny(ny)
+{
+    SetView(lookFrom, lookAt, vup, vfov, aperture, focusDist);
+    // default color generator
+    getColor = [](const Ray& r, Objects& os, int depth)
+    {
+        return Color(0, 0, 0);
+    };
+}
+
+void Camera::SetView(const Vector3& lookFrom, const Vector3& lookAt, const Vector3& vup, float vfov,
+                     float aperture, float focusDist)
 {
     lensRadius = aperture / 2;
     double theta = vfov * M_PI / 180;
@@ -56,63 +423,512 @@ Camera::Camera(const Vector3& lookFrom, const Vector3& lookAt,
     downLeftCorner = origin - halfWidth * focusDist * u - halfHeight * focusDist * v - focusDist * w;
     hv = 2 * halfWidth * focusDist * u;
     vv = 2 * halfHeight * focusDist * v;
-    // default color generator
-    getColor = [](const Ray& r, Objects& os, int depth)
-    {
-        return Color(0, 0, 0);
-    };
 }
 
 // rand ray of the pixel
 Ray Camera::GetRay(double u, double v)
 {
-    Vector3 rd = lensRadius * RandomUnitVector();
+    double u1, u2;
+    Sample2D(u1, u2);
+    Vector3 rd = lensRadius * SampleDisk(u1, u2);
     Vector3 offset = this->u * rd.e[0] + this->v * rd.e[1];
     return {origin + offset, downLeftCorner + u * hv + v * vv - origin - offset};
 }
 
-Vector3 vsqrt(const Vector3& v)
+Ray Camera::SampleRay(int i, int j, int k)
+{
+    SeedThreadRng((uint64_t) j * nx + i, k, frame, sampler.get());
+    double du, dv;
+    Sample2D(du, dv);
+    return GetRay((i + du) / nx, (j + dv) / ny);
+}
+
+void Camera::SetThreads(int threads)
+{
+    this->threads = threads;
+    pool.reset();
+}
+
+void Camera::SetPacketHandler(const PacketColorHandler& handler, int size)
+{
+    getPacketColor = handler;
+    packetSize = size * size <= RayPacket::MAX_SIZE ? max(size, 0) : 8;
+}
+
+void Camera::SetBatchHandler(const BatchColorHandler& handler, int batchSize)
 {
-    return {sqrt(v.e[0]), sqrt(v.e[1]), sqrt(v.e[2])};
+    getBatchColor = handler;
+    this->batchSize = max(batchSize, 1);
+}
+
+void Camera::SetProgressive(int samplesPerPass, double timeBudget, double snapshotInterval)
+{
+    this->samplesPerPass = samplesPerPass;
+    this->timeBudget = timeBudget;
+    this->snapshotInterval = snapshotInterval;
+}
+
+namespace
+{
+// samples per pass of a render split into passes for checkpoints
+const int CHECKPOINT_PASS_SAMPLES = 4;
+
+CheckpointInfo RenderInfo(int nx, int ny, int frame, SamplerType sampler, int samples, int passSamples,
+                          double adaptiveThreshold, int adaptiveMinSamples, int adaptiveMaxSamples,
+                          uint64_t fingerprint)
+{
+    return {nx, ny, frame, (int32_t) sampler, samples, passSamples, adaptiveThreshold, adaptiveMinSamples,
+            adaptiveMaxSamples, fingerprint};
+}
 }
 
 void Camera::Render(CachedPPM& ppm, Objects& objects)
 {
     int samples = antiAliasing ? this->aaSamples : 1;
-    int pi = 0;
+    Tile area = RenderRegion();
+    int64_t pixels = (int64_t) (area.x1 - area.x0) * (area.y1 - area.y0);
+    // build the BVH up front rather than inside the first pixel
+    objects.Prepare();
+    if (!pool)
+    {
+        pool = make_shared<ThreadPool>(threads);
+    }
+    tileTimings.clear();
+    // adaptive sampling takes up to the per pixel maximum
+    int maxSamples = adaptiveMaxSamples > 0 ? adaptiveMaxSamples : 4 * samples;
+    sampler = MakeSampler(samplerType, nx, adaptiveThreshold > 0 ? maxSamples : samples, frame);
+    ProgressTracker progress(progressMode, progressInterval);
+    progress.Start(pixels * samples);
+    RenderState state;
+    state.progress = &progress;
+    state.deadline = chrono::steady_clock::time_point::max();
+    state.start = state.lastCheckpoint = chrono::steady_clock::now();
 
-    #pragma omp parallel for schedule(dynamic)
-    for (int j = ny - 1; j >= 0; --j)
+    // checkpoints are taken between passes, a render of a single pass is split up for them
+    int passSamples = samplesPerPass;
+    unique_ptr<CheckpointWriter> checkpoints;
+    if (!checkpointPath.empty())
     {
-        for (int i = 0; i < nx; ++i)
+        if (passSamples <= 0) passSamples = CHECKPOINT_PASS_SAMPLES;
+        checkpoints.reset(new CheckpointWriter(checkpointPath));
+        state.checkpoints = checkpoints.get();
+        state.passSamples = passSamples;
+        if (resumeCheckpoint && Resume(ppm, state, samples))
         {
-            Color tmp{0, 0, 0};
-            // anti-aliasing
-            for (int k = 0; k < samples; ++k)
+            progress.Add(state.samples);
+        }
+    }
+
+    if (adaptiveThreshold > 0)
+    {
+        RenderAdaptive(ppm, objects, samples, state);
+    }
+    else if (passSamples <= 0 || passSamples >= samples)
+    {
+        ppm.StartStreaming();
+        RenderPass(ppm, objects, samples, samples, state);
+    }
+    else
+    {
+        auto lastSnapshot = state.start;
+        for (int first = state.passes * passSamples; first < samples; first += passSamples)
+        {
+            int count = min(passSamples, samples - first);
+            // the last pass finishes the pixels, its bands are written out while it runs
+            if (first + count >= samples)
+            {
+                ppm.StartStreaming();
+            }
+            if (!RenderPass(ppm, objects, count, samples, state)) break;
+            ++state.passes;
+            auto now = chrono::steady_clock::now();
+            if (timeBudget > 0)
+            {
+                // the first pass is done, from now on the budget applies
+                state.deadline = Deadline(state);
+                if (now >= state.deadline) break;
+            }
+            if (snapshotInterval > 0 && first + count < samples &&
+                chrono::duration<double>(now - lastSnapshot).count() >= snapshotInterval)
+            {
+                ppm.WriteToFile();
+                lastSnapshot = now;
+            }
+            if (first + count < samples)
             {
-                double u = (double) i / nx;
-                double v = (double) j / ny;
-                double a = (2 * 3.1415926535 * (k + drand48()) / samples);
-                u += (drand48() * cos(a)) / nx;
-                v += (drand48() * sin(a)) / ny;
-                Ray r = GetRay(u, v);
-                tmp += vsqrt(getColor(r, objects, 0)) * 255.99;
+                TakeCheckpoint(ppm, state, samples);
             }
-            tmp /= samples;
-            ppm.Write(i, j, tmp);
-            pi++;
-            LogProgress(ppm.Progress());
         }
     }
 
+    progress.Stop();
+    raysTraced = state.rays;
+    samplesTaken = state.samples;
+#ifdef RT_COUNT_ALLOCATIONS
+    printf("heap allocations while tracing: %zu\n", state.allocations.load());
+#endif
+
     // render finished
     ppm.WriteToFile();
+    if (checkpoints)
+    {
+        checkpoints->Remove();
+    }
 }
 
-void Camera::LogProgress(double percent)
+void Camera::SetAdaptive(double threshold, int minSamples, int maxSamples)
 {
-    std::cout << "\33[2K\r";
-    printf("%.2f%%", percent * 100);
+    adaptiveThreshold = threshold;
+    adaptiveMinSamples = minSamples;
+    adaptiveMaxSamples = maxSamples;
+}
+
+void Camera::SetCheckpoint(const string& path, uint64_t fingerprint, double interval, bool resume)
+{
+    checkpointPath = path;
+    checkpointFingerprint = fingerprint;
+    checkpointInterval = interval;
+    resumeCheckpoint = resume;
+}
+
+Tile Camera::RenderRegion() const
+{
+    Tile image{0, 0, nx, ny};
+    if (region.x1 <= region.x0 || region.y1 <= region.y0) return image;
+    return {max(region.x0, 0), max(region.y0, 0), min(region.x1, nx), min(region.y1, ny)};
+}
+
+chrono::steady_clock::time_point Camera::Deadline(const RenderState& state) const
+{
+    return state.start + chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<double>(timeBudget - state.elapsedBefore));
+}
+
+void Camera::RenderAdaptive(CachedPPM& ppm, Objects& objects, int samples, RenderState& state)
+{
+    Tile area = RenderRegion();
+    int64_t budget = (int64_t) (area.x1 - area.x0) * (area.y1 - area.y0) * samples;
+    int maxSamples = adaptiveMaxSamples > 0 ? adaptiveMaxSamples : 4 * samples;
+    int minSamples = min(adaptiveMinSamples, maxSamples);
+    int passSamples = samplesPerPass > 0 ? samplesPerPass : 8;
+    // a resumed render has its converged pixels and variance from the checkpoint
+    bool resumed = state.passes > 0;
+    if (!resumed)
+    {
+        state.converged.assign((size_t) nx * ny, 0);
+        ppm.Buffer().TrackVariance();
+    }
+    if (timeBudget > 0)
+    {
+        state.deadline = Deadline(state);
+    }
+
+    // every pixel gets the minimum, the deadline only applies after that
+    bool onTime = true;
+    if (!resumed)
+    {
+        auto deadline = state.deadline;
+        state.deadline = chrono::steady_clock::time_point::max();
+        onTime = RenderPass(ppm, objects, minSamples, maxSamples, state);
+        state.deadline = deadline;
+        ++state.passes;
+        TakeCheckpoint(ppm, state, samples);
+    }
+    auto lastSnapshot = state.start;
+    while (onTime && state.active > 0 && state.samples < budget)
+    {
+        // spread what is left of the budget over the pixels that still need it
+        int64_t perPixel = (budget - state.samples) / state.active;
+        int count = (int) max((int64_t) 1, min((int64_t) passSamples, perPixel));
+        onTime = RenderPass(ppm, objects, count, maxSamples, state);
+        auto now = chrono::steady_clock::now();
+        if (snapshotInterval > 0 && chrono::duration<double>(now - lastSnapshot).count() >= snapshotInterval)
+        {
+            ppm.WriteToFile();
+            lastSnapshot = now;
+        }
+        if (onTime)
+        {
+            ++state.passes;
+            TakeCheckpoint(ppm, state, samples);
+        }
+    }
+}
+
+void Camera::TakeCheckpoint(CachedPPM& ppm, RenderState& state, int samples)
+{
+    if (!state.checkpoints) return;
+    auto now = chrono::steady_clock::now();
+    if (chrono::duration<double>(now - state.lastCheckpoint).count() < checkpointInterval) return;
+    state.lastCheckpoint = now;
+
+    // the render threads are between passes, the buffers only need copying
+    FrameBuffer& buffer = ppm.Buffer();
+    size_t n = (size_t) nx * ny;
+    Checkpoint checkpoint;
+    checkpoint.info = RenderInfo(nx, ny, frame, samplerType, samples, state.passSamples, adaptiveThreshold,
+                                 adaptiveMinSamples, adaptiveMaxSamples, checkpointFingerprint);
+    checkpoint.passes = state.passes;
+    checkpoint.samples = state.samples;
+    checkpoint.elapsed = state.elapsedBefore + chrono::duration<double>(now - state.start).count();
+    checkpoint.pixels.assign(buffer.Data(), buffer.Data() + n);
+    if (buffer.LuminanceSqData())
+    {
+        checkpoint.luminanceSq.assign(buffer.LuminanceSqData(), buffer.LuminanceSqData() + n);
+    }
+    checkpoint.converged = state.converged;
+    state.checkpoints->Submit(checkpoint);
+}
+
+bool Camera::Resume(CachedPPM& ppm, RenderState& state, int samples)
+{
+    if (access(checkpointPath.c_str(), F_OK) != 0) return false;
+    Checkpoint checkpoint;
+    string error;
+    if (!LoadCheckpoint(checkpointPath.c_str(), checkpoint, error))
+    {
+        fprintf(stderr, "%s, starting over\n", error.c_str());
+        return false;
+    }
+    if (checkpoint.info.fingerprint != checkpointFingerprint)
+    {
+        fprintf(stderr, "%s: checkpoint of another scene, starting over\n", checkpointPath.c_str());
+        return false;
+    }
+    if (!(checkpoint.info == RenderInfo(nx, ny, frame, samplerType, samples, state.passSamples, adaptiveThreshold,
+                                        adaptiveMinSamples, adaptiveMaxSamples, checkpointFingerprint)))
+    {
+        fprintf(stderr, "%s: checkpoint of a render with other settings, starting over\n", checkpointPath.c_str());
+        return false;
+    }
+    FrameBuffer& buffer = ppm.Buffer();
+    copy(checkpoint.pixels.begin(), checkpoint.pixels.end(), buffer.Data());
+    if (!checkpoint.luminanceSq.empty())
+    {
+        buffer.TrackVariance();
+        copy(checkpoint.luminanceSq.begin(), checkpoint.luminanceSq.end(), buffer.LuminanceSqData());
+    }
+    state.converged = std::move(checkpoint.converged);
+    state.active = count(state.converged.begin(), state.converged.end(), 0);
+    state.passes = checkpoint.passes;
+    state.samples = checkpoint.samples;
+    state.elapsedBefore = checkpoint.elapsed;
+    printf("resuming %s: %d passes, %.0f s rendered\n", checkpointPath.c_str(), checkpoint.passes,
+           checkpoint.elapsed);
+    return true;
+}
+
+bool Camera::RenderPass(CachedPPM& ppm, Objects& objects, int count, int totalSamples, RenderState& state)
+{
+    FrameBuffer& buffer = ppm.Buffer();
+    bool adaptive = !state.converged.empty();
+    state.active = 0;
+    vector<Tile> tiles = MakeTiles(nx, ny, tileSize, tileOrder);
+    Tile area = RenderRegion();
+    if (area.x1 - area.x0 < nx || area.y1 - area.y0 < ny)
+    {
+        // the tiles of the image clipped to the region
+        size_t kept = 0;
+        for (const Tile& tile: tiles)
+        {
+            Tile clipped{max(tile.x0, area.x0), max(tile.y0, area.y0), min(tile.x1, area.x1), min(tile.y1, area.y1)};
+            if (clipped.x0 < clipped.x1 && clipped.y0 < clipped.y1) tiles[kept++] = clipped;
+        }
+        tiles.resize(kept);
+    }
+    size_t timingOffset = tileTimings.size();
+    tileTimings.resize(timingOffset + tiles.size(), TileTiming());
+    atomic<bool> expired{false};
+
+    pool->ParallelFor((int) tiles.size(), [&](int t, int worker)
+    {
+        const Tile& tile = tiles[t];
+        auto start = chrono::steady_clock::now();
+        int64_t raysBefore = ThreadRayCount();
+        if (start >= state.deadline)
+        {
+            expired = true;
+            return;
+        }
+        if ((getBatchColor || packetSize > 0) && !adaptive)
+        {
+            if (getBatchColor)
+            {
+                RenderTileBatch(ppm, objects, tile, count, state);
+            }
+            else
+            {
+                RenderTilePackets(ppm, objects, tile, count, state);
+            }
+            state.rays += ThreadRayCount() - raysBefore;
+            tileTimings[timingOffset + t] = {
+                    tile, chrono::duration<double>(chrono::steady_clock::now() - start).count(), worker
+            };
+            return;
+        }
+        int64_t tileSamples = 0, tileActive = 0;
+        for (int j = tile.y1 - 1; j >= tile.y0; --j)
+        {
+            for (int i = tile.x0; i < tile.x1; ++i)
+            {
+                size_t index = (size_t) j * nx + i;
+                if (adaptive && state.converged[index]) continue;
+                Color tmp{0, 0, 0};
+                double luminanceSq = 0;
+                int firstSample = (int) buffer.At(i, j).n;
+#ifdef RT_COUNT_ALLOCATIONS
+                size_t allocationsBefore = ThreadAllocationCount();
+#endif
+                // anti-aliasing
+                for (int k = firstSample; k < firstSample + count; ++k)
+                {
+                    Ray r = SampleRay(i, j, k);
+                    Color c = getColor(r, objects, 0);
+                    tmp += c;
+                    if (adaptive)
+                    {
+                        luminanceSq += Luminance(c) * Luminance(c);
+                    }
+                }
+#ifdef RT_COUNT_ALLOCATIONS
+                state.allocations += ThreadAllocationCount() - allocationsBefore;
+#endif
+                if (adaptive)
+                {
+                    buffer.Add(i, j, tmp, luminanceSq, count);
+                    int n = firstSample + count;
+                    if (n >= totalSamples || buffer.RelativeError(i, j) < adaptiveThreshold)
+                    {
+                        state.converged[index] = 1;
+                    }
+                    else
+                    {
+                        ++tileActive;
+                    }
+                }
+                else
+                {
+                    ppm.Write(i, j, tmp, count);
+                }
+                tileSamples += count;
+            }
+            // one update per tile row keeps the shared counters cold
+            state.progress->Add(tileSamples);
+            state.samples += tileSamples;
+            tileSamples = 0;
+        }
+        state.active += tileActive;
+        state.rays += ThreadRayCount() - raysBefore;
+        tileTimings[timingOffset + t] = {
+                tile, chrono::duration<double>(chrono::steady_clock::now() - start).count(), worker
+        };
+    });
+    return !expired;
+}
+
+void Camera::RenderTilePackets(CachedPPM& ppm, Objects& objects, const Tile& tile, int count, RenderState& state)
+{
+    FrameBuffer& buffer = ppm.Buffer();
+    RayPacket packet;
+    Color sums[RayPacket::MAX_SIZE];
+    int firstSample[RayPacket::MAX_SIZE];
+    // generator of each ray right after its camera ray was made, so shading
+    // sees the same numbers as when the sample is traced on its own
+    Rng rngs[RayPacket::MAX_SIZE];
+    for (int y1 = tile.y1; y1 > tile.y0; y1 -= packetSize)
+    {
+        int y0 = max(y1 - packetSize, tile.y0);
+#ifdef RT_COUNT_ALLOCATIONS
+        size_t allocationsBefore = ThreadAllocationCount();
+#endif
+        for (int x0 = tile.x0; x0 < tile.x1; x0 += packetSize)
+        {
+            int x1 = min(x0 + packetSize, tile.x1);
+            int lanes = (x1 - x0) * (y1 - y0);
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                sums[lane] = {0, 0, 0};
+                firstSample[lane] = (int) buffer.At(x0 + lane % (x1 - x0), y0 + lane / (x1 - x0)).n;
+            }
+            for (int s = 0; s < count; ++s)
+            {
+                packet.Clear();
+                for (int lane = 0; lane < lanes; ++lane)
+                {
+                    int i = x0 + lane % (x1 - x0), j = y0 + lane / (x1 - x0);
+                    int k = firstSample[lane] + s;
+                    packet.Add(SampleRay(i, j, k));
+                    rngs[lane] = ThreadRng();
+                }
+                packet.Prepare(MAXFLOAT);
+                objects.IsHit(packet, 0);
+                for (int lane = 0; lane < lanes; ++lane)
+                {
+                    ThreadRng() = rngs[lane];
+                    sums[lane] += getPacketColor(packet, lane, objects);
+                }
+            }
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                ppm.Write(x0 + lane % (x1 - x0), y0 + lane / (x1 - x0), sums[lane], count);
+            }
+        }
+#ifdef RT_COUNT_ALLOCATIONS
+        state.allocations += ThreadAllocationCount() - allocationsBefore;
+#endif
+        int64_t rowSamples = (int64_t) (y1 - y0) * (tile.x1 - tile.x0) * count;
+        state.progress->Add(rowSamples);
+        state.samples += rowSamples;
+    }
+}
+
+void Camera::RenderTileBatch(CachedPPM& ppm, Objects& objects, const Tile& tile, int count, RenderState& state)
+{
+    FrameBuffer& buffer = ppm.Buffer();
+    // kept per thread, so a render allocates them once
+    static thread_local vector<Ray> rays;
+    static thread_local vector<Rng> rngs;
+    static thread_local vector<Color> colors, sums;
+    static thread_local vector<int> pixels;
+    int width = tile.x1 - tile.x0, height = tile.y1 - tile.y0;
+    rays.resize(batchSize);
+    rngs.resize(batchSize);
+    colors.resize(batchSize);
+    pixels.resize(batchSize);
+    sums.assign((size_t) width * height, {0, 0, 0});
+
+#ifdef RT_COUNT_ALLOCATIONS
+    size_t allocationsBefore = ThreadAllocationCount();
+#endif
+    // samples are numbered pixel by pixel, rows from the top, and cut into batches
+    int64_t total = (int64_t) width * height * count;
+    for (int64_t begin = 0; begin < total; begin += batchSize)
+    {
+        int size = (int) min((int64_t) batchSize, total - begin);
+        for (int b = 0; b < size; ++b)
+        {
+            int pixel = (int) ((begin + b) / count);
+            int i = tile.x0 + pixel % width, j = tile.y1 - 1 - pixel / width;
+            int k = (int) buffer.At(i, j).n + (int) ((begin + b) % count);
+            rays[b] = SampleRay(i, j, k);
+            rngs[b] = ThreadRng();
+            pixels[b] = pixel;
+        }
+        getBatchColor(rays.data(), rngs.data(), size, objects, colors.data());
+        for (int b = 0; b < size; ++b)
+        {
+            sums[pixels[b]] += colors[b];
+        }
+        state.progress->Add(size);
+        state.samples += size;
+    }
+#ifdef RT_COUNT_ALLOCATIONS
+    state.allocations += ThreadAllocationCount() - allocationsBefore;
+#endif
+    for (int pixel = 0; pixel < width * height; ++pixel)
+    {
+        ppm.Write(tile.x0 + pixel % width, tile.y1 - 1 - pixel / width, sums[pixel], count);
+    }
 }
 
 Vector3 Refrect(const Vector3& income, const Vector3& n, double r)
@@ -163,8 +979,21 @@ std::ostream& operator<<(std::ostream& os, const Vector3& v)
 
 PPM::PPM(int nx, int ny, const char *filePath) : filePath(filePath)
 {
-    fout = new ofstream(filePath);
-    *fout << "P3\n" << nx << " " << ny << "\n255\n";
+    fout = new ofstream(filePath, ios::binary);
+    *fout << PPMHeader(nx, ny);
+    buffer.reserve(1 << 20);
+}
+
+PPM::~PPM()
+{
+    Flush();
+    delete fout;
+}
+
+void PPM::Flush()
+{
+    fout->write((const char*) buffer.data(), buffer.size());
+    buffer.clear();
 }
 
 void PPM::Write(Color &pix)
@@ -179,7 +1008,12 @@ void PPM::Write(Color &pix)
         pix.e[1] /= max / 255.99;
         pix.e[2] /= max / 255.99;
     }
-    *fout << (int) pix.e[0] << "\t" << (int) pix.e[1] << "\t" << (int) pix.e[2] << "\n";
+    buffer.resize(buffer.size() + 3);
+    QuantizePixel(pix, &buffer[buffer.size() - 3]);
+    if (buffer.size() + 3 > buffer.capacity())
+    {
+        Flush();
+    }
 }
 
 CachedPPM::CachedPPM(int nx, int ny, const char *filePath)
@@ -187,40 +1021,158 @@ CachedPPM::CachedPPM(int nx, int ny, const char *filePath)
     this->nx = nx;
     this->ny = ny;
     this->filePath = filePath;
-    colorCache = new Color[nx * ny];
-    sum = 0;
+    buffer = new FrameBuffer(nx, ny);
 }
 
-#define max(a, b) (a > b ? a : b)
-void CachedPPM::Write(int x, int y, const Color &c)
+CachedPPM::~CachedPPM()
 {
-    int offset = y * nx + x;
-    colorCache[offset] = c;
-    double max = max(c.e[0], c.e[1]);
-    max = max(max, c.e[2]);
-    if (max > 255.99)
+    StopWriter();
+    if (streamFd >= 0) close(streamFd);
+    delete buffer;
+}
+
+void CachedPPM::Write(int x, int y, const Color &sum, int samples)
+{
+    buffer->Add(x, y, sum, samples);
+    if (streamFd >= 0)
     {
-        colorCache[offset] /= max / 255.99;
+        int band = y / bandHeight;
+        int bandSize = nx * (min((band + 1) * bandHeight, ny) - band * bandHeight);
+        // the thread finishing a band queues it for the writer
+        if (bandPixels[band].fetch_add(1, memory_order_acq_rel) + 1 == bandSize)
+        {
+            if (completed->Push(band))
+            {
+                // without the lock, the writer's timed wait covers a missed wakeup
+                bandReady.notify_one();
+            }
+            else
+            {
+                WriteBand(band);
+            }
+        }
     }
-    recursive_mutex _m;
-    synchronized {
-        ++this->sum;
+}
+
+void CachedPPM::StartStreaming()
+{
+    if (bandHeight <= 0 || !filePath) return;
+    StopWriter();
+    if (streamFd >= 0) close(streamFd);
+    streamFd = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (streamFd < 0) return;
+    string header = PPMHeader(nx, ny);
+    headerSize = header.size();
+    if (pwrite(streamFd, header.data(), headerSize, 0) != (ssize_t) headerSize)
+    {
+        close(streamFd);
+        streamFd = -1;
+        return;
     }
+    rgb.assign((size_t) nx * ny * 3, 0);
+    writeFailed = false;
+    int bands = (ny + bandHeight - 1) / bandHeight;
+    bandPixels.reset(new atomic<int>[bands]);
+    for (int b = 0; b < bands; ++b)
+    {
+        bandPixels[b] = 0;
+    }
+    // every band is queued at most once, the queue never fills up
+    completed.reset(new BoundedQueue<int>(bands));
+    finishing = false;
+    writer = thread(&CachedPPM::WriterLoop, this);
 }
 
-void CachedPPM::WriteToFile()
+void CachedPPM::WriterLoop()
 {
-    ofstream fout(filePath);
-    fout << "P3\n" << nx << " " << ny << "\n255\n";
+    int band;
+    while (true)
+    {
+        if (completed->Pop(band))
+        {
+            WriteBand(band);
+            continue;
+        }
+        // the render threads are done once finishing is set, what they queued is visible
+        if (finishing.load(memory_order_acquire))
+        {
+            while (completed->Pop(band)) WriteBand(band);
+            return;
+        }
+        unique_lock<mutex> lock(writerMutex);
+        bandReady.wait_for(lock, chrono::milliseconds(2));
+    }
+}
 
-    for (int j = 0; j < ny; ++j)
+void CachedPPM::StopWriter()
+{
+    if (!writer.joinable()) return;
+    finishing.store(true, memory_order_release);
+    bandReady.notify_one();
+    writer.join();
+}
+
+void CachedPPM::WriteBand(int band)
+{
+    int y0 = band * bandHeight, y1 = min(y0 + bandHeight, ny);
+    buffer->Tonemap(y0, y1, &rgb[(size_t) y0 * nx * 3]);
+    size_t size = (size_t) (y1 - y0) * nx * 3;
+    size_t start = (size_t) y0 * nx * 3;
+    const unsigned char* p = &rgb[start];
+    off_t offset = headerSize + start;
+    // pwrite may write less than asked for, a full disk fails it
+    while (size > 0)
+    {
+        ssize_t n = pwrite(streamFd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+        {
+            writeFailed = true;
+            return;
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+void CachedPPM::Reset(const char* filePath)
+{
+    StopWriter();
+    if (streamFd >= 0) close(streamFd);
+    streamFd = -1;
+    this->filePath = filePath;
+    buffer->Clear();
+}
+
+bool CachedPPM::WriteToFile()
+{
+    if (!filePath) return true;
+    if (streamFd >= 0)
     {
-        for (int i = 0; i < nx; ++i)
+        // complete bands are written by the writer thread, the rest here
+        StopWriter();
+        int bands = (ny + bandHeight - 1) / bandHeight;
+        for (int b = 0; b < bands; ++b)
         {
-            int offset = j * nx + i;
-            fout << (int) colorCache[offset].e[0] << "\t"
-                 << (int) colorCache[offset].e[1] << "\t"
-                 << (int) colorCache[offset].e[2] << "\n";
+            int bandSize = nx * (min((b + 1) * bandHeight, ny) - b * bandHeight);
+            if (bandPixels[b].load() < bandSize)
+            {
+                WriteBand(b);
+            }
         }
+        bool ok = close(streamFd) == 0 && !writeFailed;
+        streamFd = -1;
+        if (!ok) fprintf(stderr, "%s: write failed\n", filePath);
+        return ok;
     }
-}
\ No newline at end of file
+
+    vector<unsigned char> pixels((size_t) nx * ny * 3);
+    buffer->Tonemap(0, ny, pixels.data());
+    if (WriteP6(filePath, nx, ny, pixels.data()) != 0)
+    {
+        fprintf(stderr, "%s: write failed\n", filePath);
+        return false;
+    }
+    return true;
+}
@@ -1,6 +1,12 @@
 #pragma once
 
 #include "stdafx.h"
+#include "tile.h"
+#include "progress.h"
+#include "sampler.h"
+
+#include <new>
+#include <type_traits>
 
 #define SURFACE_THICKNESS 0.00000001
 
@@ -8,16 +14,20 @@ class Color;
 class Vector3;
 class Material;
 class HitRecord;
+class AABB;
+class BVH;
+class SphereSoA;
+struct RayPacket;
+class Rng;
+class ThreadPool;
+class FrameBuffer;
+class Arena;
+class CheckpointWriter;
+template <class T> class BoundedQueue;
+struct TriangleMesh;
 
 extern double drand48(void);
 
-//#define synchronized(m) \
-//    for(std::unique_lock<std::recursive_mutex> lk(m); lk; lk.unlock())
-
-static int __mutexIndex__ = 0;
-#define synchronized std::recursive_mutex _m_##__mutexIndex__;\
-    ++__mutexIndex__;\
-    for (std::unique_lock<std::recursive_mutex> lk(_m_##__mutexIndex__); lk; lk.unlock())
 /**
  * Common 3-d vector definition
  */
@@ -49,7 +59,11 @@ public:
     friend std::ostream& operator<<(std::ostream& os, const Vector3& v);
 };
 
-Vector3 RandomUnitVector();
+/* Map a point of the unit square uniformly onto the unit sphere */
+Vector3 SampleSphere(double u1, double u2);
+
+/* Map a point of the unit square uniformly into the unit disk at z = 0, concentrically */
+Vector3 SampleDisk(double u1, double u2);
 
 /*
  * described by P = A + k·B
@@ -74,6 +88,26 @@ protected:
     Vector3 A, B;
 };
 
+/*
+ * Axis-aligned bounding box. An empty box has pMin > pMax
+ * so that extending it with any point or box yields that point or box.
+ */
+class AABB
+{
+public:
+    AABB();
+    AABB(const Vector3& pMin, const Vector3& pMax) : pMin(pMin), pMax(pMax) { }
+    void Extend(const Vector3& p);
+    void Extend(const AABB& box);
+    Vector3 Centroid() const { return (pMin + pMax) * 0.5; }
+    double SurfaceArea() const;
+    int LongestAxis() const;
+    // slab test, invDir holds the reciprocal of the ray direction
+    inline bool IsHit(const Vector3& origin, const Vector3& invDir,
+                      double minT, double maxT, double& entryT) const;
+    Vector3 pMin, pMax;
+};
+
 /*
  * I'm wondering if the definition of Color is meaningful...
  * Maybe a typedef is enough :(
@@ -90,6 +124,32 @@ struct ScatterInfo
 {
     Vector3 attenuation;
     Ray outRay;
+    // relative chance of following this ray when only one of them is traced
+    double weight;
+};
+
+/*
+ * Fixed capacity list of scattered rays, stored inline in the hit record
+ * so that scattering never touches the heap. No material scatters more
+ * than CAPACITY rays.
+ */
+class ScatterList
+{
+public:
+    static const int CAPACITY = 4;
+    void push_back(const ScatterInfo& info) { assert(count < CAPACITY); items[count++] = info; }
+    void clear() { count = 0; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    ScatterInfo& operator[](int i) { return items[i]; }
+    const ScatterInfo& operator[](int i) const { return items[i]; }
+    ScatterInfo* begin() { return items; }
+    ScatterInfo* end() { return items + count; }
+    const ScatterInfo* begin() const { return items; }
+    const ScatterInfo* end() const { return items + count; }
+private:
+    ScatterInfo items[CAPACITY];
+    int count = 0;
 };
 
 
@@ -102,10 +162,42 @@ struct HitRecord
     HitRecord() = default;
     HitRecord(
             double t, const Vector3& p, const Vector3 normal, const Material& m
-    ) : t(t), p(p), normal(normal), scatterInfos(scatterInfos) { }
+    ) : t(t), p(p), normal(normal) { }
     double t;
     Vector3 p, normal;
-    std::vector<ScatterInfo> scatterInfos;
+    bool backFace = false;          // normal was flipped to face the ray, glass flips it back
+    ScatterList scatterInfos;
+};
+
+// closest hit of a ray, object is an index into Objects
+struct Hit
+{
+    double t;
+    int object;
+};
+
+/* Concrete material types, lets batched renderers group hits by material */
+enum class MaterialKind
+{
+    Other,
+    Lambertian,
+    Metal,
+    Glass,
+    Emissive
+};
+
+/*
+ * A material stored by value in the scene's material table. The kind tells
+ * which of the built-in materials it is and which fields apply: color is the
+ * attenuation or emitted radiance, ior the refractive index of glass.
+ * Materials of kind Other are only reached through the material pointer.
+ */
+struct MaterialRecord
+{
+    MaterialKind kind;
+    Color color;
+    double ior;
+    const Material* material;
 };
 
 /*
@@ -116,7 +208,26 @@ class Material
 {
 public:
     virtual bool Scatter(
-            const Ray &r, HitRecord &hr) const { hr.scatterInfos = {}; };
+            const Ray &r, HitRecord &hr) const { hr.scatterInfos.clear(); return false; };
+    virtual MaterialKind Kind() const { return MaterialKind::Other; }
+
+    /* The material by value, the built-in materials are shaded from it without virtual calls */
+    virtual MaterialRecord Record() const;
+
+    /* Radiance the surface emits, lights are objects with an emissive material */
+    virtual Color Emitted() const;
+
+    /*
+     * For light sampling: whether Evaluate works, i.e. the material
+     * scatters over a range of directions rather than a few discrete ones.
+     */
+    virtual bool Diffuse() const { return false; }
+
+    /*
+     * f * cos of scattering r into dir at the hit, and the solid angle pdf
+     * of Scatter picking dir. Only for diffuse materials.
+     */
+    virtual void Evaluate(const Ray& r, const HitRecord& hr, const Vector3& dir, Color& f, double& pdf) const;
 };
 
 /**
@@ -128,18 +239,160 @@ public:
     Object(const Material& m): material(m) {   }
     // decide whether the ray r hits this object.
     virtual bool IsHit(const Ray& r, double minT, double maxT, HitRecord& hitRec) = 0;
+    // whether r hits this object at all in (minT, maxT)
+    virtual bool Occluded(const Ray& r, double minT, double maxT)
+    {
+        HitRecord hitRec;
+        return IsHit(r, minT, maxT, hitRec);
+    }
+    // bounds of the object, used to build acceleration structures
+    virtual AABB BoundingBox() const = 0;
     const Material& material;
 };
 
+/* Memory a scene takes up, in bytes */
+struct SceneMemory
+{
+    size_t arenaUsed, arenaReserved;    // objects and materials stored in the scene
+    size_t tables;                      // object, material and light lists
+    size_t bvh;
+    size_t spheres;                     // SIMD sphere layout
+    size_t meshes;                      // vertex and index buffers
+    int heapObjects;                    // objects given to Add, not counted in the bytes
+    size_t Total() const { return arenaReserved + tables + bvh + spheres + meshes; }
+    void Print() const;
+};
+
+/* Rays the calling thread has traced through Objects so far: closest hit, any hit and packet rays */
+inline int64_t& ThreadRayCount()
+{
+    static thread_local int64_t rays = 0;
+    return rays;
+}
+
+/*
+ * The scene. Queries go through a BVH which is (re)built lazily
+ * on the first query after objects were added.
+ * Spheres and materials can be stored in the scene itself: they are
+ * placed one after another in an arena, addressed by index, and freed all
+ * at once by Release. Objects given to Add are owned by the scene too but
+ * live on the heap, materials passed to them stay the caller's. Meshes
+ * keep their buffers on the heap, their triangles go to the arena.
+ */
 class Objects
 {
 public:
+    Objects();
+    /* Closest hit, shaded: Intersect followed by Shade */
     virtual bool IsHit(const Ray& r, double minT, double maxT, HitRecord& hitRec);
-    void Add(Object* hittable) { objects.push_back(hittable); }
-    void Release() { for (auto* p: objects) delete p; }
-    ~Objects() { Release(); }
+
+    /* Closest hit only, without hit point, normal or scattering */
+    bool Intersect(const Ray& r, double minT, double maxT, Hit& hit);
+
+    /* Whether anything is hit in (minT, maxT), stops at the first hit found. For shadow rays */
+    bool Occluded(const Ray& r, double minT, double maxT);
+
+    /*
+     * Closest hits of a prepared packet of rays, left in packet.object and
+     * packet.tMax. Like Intersect nothing else is computed.
+     */
+    void IsHit(RayPacket& packet, double minT);
+
+    /* Hit point and normal of a hit found by Intersect, not scattered yet */
+    void Surface(const Ray& r, const Hit& hit, double minT, HitRecord& hitRec);
+
+    /* Surface plus the scattered rays of the object's material */
+    void Shade(const Ray& r, const Hit& hit, double minT, HitRecord& hitRec);
+    const Material& MaterialOf(int object) const { return objects[object]->material; }
+
+    /* Material of an object from the material table. Up to date after Prepare */
+    const MaterialRecord& MaterialAt(int object) const { return materials[materialIndex[object]]; }
+    Object* Get(int object) const { return objects[object]; }
+
+    /* Emissive spheres, the lights that can be sampled directly. Up to date after Prepare */
+    const std::vector<int>& Lights() const { return lights; }
+
+    /* Take a heap object, owned by the scene from now on and deleted as a T by Release */
+    template <class T>
+    void Add(T* hittable)
+    {
+        static_assert(std::is_base_of<Object, T>::value, "only objects can be added");
+        // Object has no virtual destructor, the deleter remembers the concrete type
+        heapObjects.push_back({hittable, [](Object* p) { delete static_cast<T*>(p); }});
+        objects.push_back(hittable);
+        bvhDirty = true;
+        allSpheres = false;
+    }
+
+    /* Copy a material into the scene, returns its index for AddSphere */
+    template <class M>
+    int AddMaterial(const M& m)
+    {
+        static_assert(std::is_trivially_destructible<M>::value, "scene materials are never destroyed");
+        return StoreMaterial(new (ArenaAllocate(sizeof(M), alignof(M))) M(m));
+    }
+
+    /* Sphere stored in the scene with material `material` from AddMaterial, returns its object index */
+    int AddSphere(const Vector3& center, double radius, int material);
+    const Material& SceneMaterial(int material) const { return *sceneMaterials[material]; }
+
+    /*
+     * Move a mesh into the scene, each triangle becomes an object of
+     * material `material` from AddMaterial. Returns the first one's index
+     */
+    int AddMesh(TriangleMesh&& mesh, int material);
+
+    /*
+     * Move a sphere to a new center, for animation. The next Prepare refits
+     * the BVH to the moved spheres instead of building it again, unless the
+     * tree has come to fit the scene much worse than a new one would.
+     * Not while rendering.
+     */
+    void MoveSphere(int object, const Vector3& center);
+
+    /* Make room for count more objects */
+    void Reserve(int count) { objects.reserve(objects.size() + count); }
+
+    /* Remove everything, the arena keeps its blocks for the next scene */
+    void Release();
+    int Size() const { return (int) objects.size(); }
+    SceneMemory Memory() const;
+
+    /* Disable to fall back to testing every object, mostly for benchmarking */
+    void SetAcceleration(bool enabled) { useBvh = enabled; }
+    // build or refit the BVH now if it is out of date, thread-safe
+    void Prepare();
+    ~Objects();
 protected:
+    // closest object of a BVH leaf hit before tMax, which it lowers, or -1
+    int IntersectLeaf(const Ray& r, int first, int count, double minT, double& tMax);
+    void* ArenaAllocate(size_t size, size_t align);
+    int StoreMaterial(const Material* m);
+
     std::vector<Object*> objects;
+    struct HeapObject
+    {
+        Object* object;
+        void (*destroy)(Object*);
+    };
+    std::vector<HeapObject> heapObjects;
+    std::vector<const Material*> sceneMaterials;
+    std::vector<TriangleMesh*> meshes;
+    Arena* arena;
+    std::vector<int> lights;
+    // every distinct material once, and the index of each object's material in it
+    std::vector<MaterialRecord> materials;
+    std::vector<int> materialIndex;
+    BVH* bvh;
+    // spheres in BVH leaf order for the SIMD kernels
+    SphereSoA* spheres;
+    bool allSpheres = false;
+    bool useBvh = true;
+    std::atomic<bool> bvhDirty{false};
+    // spheres moved since the BVH was built or refit
+    std::vector<int> moved;
+    std::atomic<bool> refitDirty{false};
+    std::mutex bvhMutex;
 };
 
 /*
@@ -148,43 +401,91 @@ protected:
  */
 typedef std::function<Color(const Ray&, Objects&, int)> ColorHandler;
 
-// PPM writer
+/*
+ * Color handler for packets of primary rays: the packet has been traced,
+ * the handler shades ray `ray` of it and follows its bounces one by one.
+ */
+typedef std::function<Color(const RayPacket&, int, Objects&)> PacketColorHandler;
+
+/*
+ * Color handler for batches of camera rays, fills colors[i] for rays[i]
+ * starting from generator state rngs[i] and returns the rays it traced.
+ */
+typedef std::function<int64_t(const Ray* rays, const Rng* rngs, int count, Objects&, Color* colors)>
+        BatchColorHandler;
+
+// PPM writer, pixels are buffered and written in large blocks
 class PPM
 {
 public:
     PPM(int nx, int ny, const char* filePath);
     // Could change the value of color if rgb values exceed 255
     void Write(Color &c);
-    ~PPM() { delete fout; }
+    ~PPM();
 protected:
+    void Flush();
     const char* filePath;
     std::ofstream *fout;
+    std::vector<unsigned char> buffer;
 };
 
 /* All Write operations are done in memory first.
  * Call WriteToFile() to save changes to file.
  * Being add to support multi-thread rendering.
+ * Pixels are accumulated in linear space in a float FrameBuffer and
+ * only tonemapped to 8-bit when written out.
+ * In streaming mode every band of rows is handed to a writer thread as
+ * soon as all of its pixels are written, through a lock-free queue, so the
+ * render threads never wait on tonemapping or the disk. WriteToFile() then
+ * only waits for the last bands and finishes the file.
  */
 class CachedPPM
 {
 public:
+    /* A null filePath keeps the image in memory, WriteToFile then does nothing */
     CachedPPM(int nx, int ny, const char* filePath);
 
-    void WriteToFile();
+    /* False, with the error printed to stderr, if the file or a streamed band could not be written */
+    bool WriteToFile();
+
+    /* Add the sum of `samples` linear samples to a pixel,
+     * thread-safe as long as threads write different pixels */
+    void Write(int x, int y, const Color &sum, int samples);
 
-    /* not thread-safe */
-    void Write(int x, int y, const Color &c);
+    FrameBuffer& Buffer() { return *buffer; }
 
-    inline double Progress() { return sum / ((double) nx * ny); }
+    /* Start the next image in the same buffers: clear them, the image goes to filePath */
+    void Reset(const char* filePath);
 
-    inline void ClearProgress() { sum = 0; }
+    /* Stream bands of bandHeight rows (32 by default) while rendering, 0 to turn streaming off */
+    void SetStreaming(int bandHeight) { this->bandHeight = bandHeight; }
 
-    ~CachedPPM() { delete colorCache; }
+    /* Create the file and start the writer thread for streaming, called
+     * before the first Write of the pass that completes the pixels */
+    void StartStreaming();
+
+    ~CachedPPM();
 private:
+    void WriteBand(int band);
+    void WriterLoop();
+    // stop the writer thread once it has written every band queued
+    void StopWriter();
     int nx, ny;
     const char* filePath;
-    Color* colorCache;
-    int sum;
+    FrameBuffer* buffer;
+
+    int bandHeight = 32;
+    int streamFd = -1;
+    size_t headerSize = 0;
+    std::vector<unsigned char> rgb;
+    std::unique_ptr<std::atomic<int>[]> bandPixels;
+    // completed bands on their way to the writer thread
+    std::unique_ptr<BoundedQueue<int>> completed;
+    std::thread writer;
+    std::mutex writerMutex;
+    std::condition_variable bandReady;
+    std::atomic<bool> finishing{false};
+    std::atomic<bool> writeFailed{false};   // a band could not be written
 };
 
 class Camera
@@ -194,14 +495,142 @@ public:
            const Vector3& vup, float vfov, float aperture, float focusDist,
            int nx, int ny);
     Ray GetRay(double u, double v);
+
+    /* Move the camera, for the next frame of an animation */
+    void SetView(const Vector3& lookFrom, const Vector3& lookAt, const Vector3& vup, float vfov, float aperture,
+                 float focusDist);
     void SetAntiAliasing(bool aa) { antiAliasing = aa; }
 
     /* Set number of samples for each pixel the camera would take when rendering */
     void SetAaSamples(int samples) { aaSamples = samples; }
     void SetColorHandler(const ColorHandler& handler) { getColor = handler; }
+
+    /*
+     * Trace the primary rays of size x size pixel blocks (4 or 8) as packets
+     * and shade them with handler, which should match the color handler.
+     * Adaptive sampling keeps tracing single rays. Size 0 turns packets off.
+     */
+    void SetPacketHandler(const PacketColorHandler& handler, int size);
+
+    /*
+     * Trace each tile's samples in batches of up to batchSize camera rays
+     * with handler (a WavefrontTracer), which should match the color handler.
+     * Takes precedence over packets; adaptive sampling keeps tracing single
+     * rays. A null handler turns batches off.
+     */
+    void SetBatchHandler(const BatchColorHandler& handler, int batchSize = 4096);
+
+    /* Frame number, picks a different random sequence for every frame */
+    void SetFrame(int frame) { this->frame = frame; }
+
+    /* Where the aa, lens and bounce samples come from */
+    void SetSampler(SamplerType type) { samplerType = type; }
+
+    /* Pixels are rendered in square tiles, handed out to the worker threads in this order */
+    void SetTiles(int size, TileOrder order) { tileSize = size; tileOrder = order; }
+
+    /* Number of render threads, <= 0 for one per hardware thread */
+    void SetThreads(int threads);
+
+    /* Only render the pixels of region, the rest of the frame buffer is left alone. An empty region renders them all */
+    void SetRegion(const Tile& region) { this->region = region; }
+
+    int Width() const { return nx; }
+    int Height() const { return ny; }
+    int SamplesPerPixel() const { return antiAliasing ? aaSamples : 1; }
+
+    /* Timings of the tiles of the last Render call, one per tile and pass */
+    const std::vector<TileTiming>& TileTimings() const { return tileTimings; }
+
+    /* Rays traced and samples taken by the last Render call, a resumed render counts its samples from before */
+    int64_t RaysTraced() const { return raysTraced; }
+    int64_t SamplesTaken() const { return samplesTaken; }
+
+    /* How progress is reported while rendering, interval is in seconds */
+    void SetProgress(ProgressMode mode, double interval = 0.5) { progressMode = mode; progressInterval = interval; }
+
+    /*
+     * Render progressively: passes of samplesPerPass samples per pixel are
+     * added to the frame buffer until the aa samples are taken or timeBudget
+     * seconds are up, whichever comes first. The first pass always completes.
+     * Every snapshotInterval seconds the image so far is written out.
+     * Zero turns the budget, the snapshots or progressive rendering off.
+     */
+    void SetProgressive(int samplesPerPass, double timeBudget = 0, double snapshotInterval = 0);
+
+    /*
+     * Adaptive sampling, the aa samples become the average budget per pixel.
+     * Every pixel gets minSamples samples first; after that only pixels whose
+     * relative error is still above threshold get more, a pass at a time,
+     * up to maxSamples (0 for 4x the aa samples) each, until the budget is spent.
+     * A threshold of 0 turns adaptive sampling off.
+     */
+    void SetAdaptive(double threshold, int minSamples = 16, int maxSamples = 0);
+
+    /*
+     * Save the render to a checkpoint file at path at most every interval
+     * seconds, written by a thread of its own, and remove the file once the
+     * image is done. Checkpoints are taken between passes, without
+     * progressive rendering the samples are split into passes of 4 for them.
+     * With resume a render picks up from the checkpoint at path, if there is
+     * one of a render with the same settings and fingerprint, and ends up
+     * with the same image as if it had never stopped. The fingerprint stands
+     * for what the camera cannot check itself, the scene and the color
+     * handler's settings, such as Scene::Fingerprint. An empty path turns
+     * checkpoints off.
+     */
+    void SetCheckpoint(const std::string& path, uint64_t fingerprint, double interval = 60, bool resume = true);
     void Render(CachedPPM& ppm, Objects& objects);
-    void LogProgress(double percent);
 protected:
+    // state shared by the passes of one Render call
+    struct RenderState
+    {
+        ProgressTracker* progress;
+        std::chrono::steady_clock::time_point deadline;
+        std::atomic<size_t> allocations{0};
+        std::atomic<int64_t> samples{0};
+        std::atomic<int64_t> rays{0};
+        // adaptive sampling only, a flag per pixel and the number of pixels still sampled
+        std::vector<unsigned char> converged;
+        std::atomic<int64_t> active{0};
+        // checkpoints only: passes done, also those before a resume, and the render time before it
+        CheckpointWriter* checkpoints = nullptr;
+        int passSamples = 0;
+        int passes = 0;
+        double elapsedBefore = 0;
+        std::chrono::steady_clock::time_point start, lastCheckpoint;
+    };
+
+    /* Add count samples to every pixel that has not converged, numbering them
+     * on from the samples the pixel already has. totalSamples is the per
+     * pixel maximum with adaptive sampling. Returns false if the deadline
+     * stopped the pass early */
+    bool RenderPass(CachedPPM& ppm, Objects& objects, int count, int totalSamples, RenderState& state);
+
+    /* Same as one tile of RenderPass without adaptive sampling, with packets of primary rays */
+    void RenderTilePackets(CachedPPM& ppm, Objects& objects, const Tile& tile, int count, RenderState& state);
+
+    /* Same as RenderTilePackets, with the samples traced in batches */
+    void RenderTileBatch(CachedPPM& ppm, Objects& objects, const Tile& tile, int count, RenderState& state);
+
+    /* Start the thread's stream for sample k of pixel (i, j) and make its camera ray */
+    Ray SampleRay(int i, int j, int k);
+
+    /* Render loop for adaptive sampling */
+    void RenderAdaptive(CachedPPM& ppm, Objects& objects, int samples, RenderState& state);
+
+    /* Hand a checkpoint to the writer if one is due, between two passes */
+    void TakeCheckpoint(CachedPPM& ppm, RenderState& state, int samples);
+
+    /* Load the checkpoint into the buffer and state if there is one of this render */
+    bool Resume(CachedPPM& ppm, RenderState& state, int samples);
+
+    // region rendered, the whole image unless SetRegion was given one
+    Tile RenderRegion() const;
+
+    // deadline of the time budget, which the time rendered before a resume counts against
+    std::chrono::steady_clock::time_point Deadline(const RenderState& state) const;
+
     bool antiAliasing = true;
     int aaSamples = 100;    // amount of sample token for each pixel
     Vector3 origin;
@@ -212,12 +641,55 @@ protected:
     // the color handler will decide each pixel's color
     // it is the most important method
     ColorHandler getColor;
+    PacketColorHandler getPacketColor;
+    int packetSize = 0;
+    BatchColorHandler getBatchColor;
+    int batchSize = 4096;
     float lensRadius;
+    int frame = 0;
+    SamplerType samplerType = SamplerType::Sobol;
+    std::unique_ptr<Sampler> sampler;
+    int tileSize = 32;
+    TileOrder tileOrder = TileOrder::Morton;
+    int threads = 0;
+    Tile region{0, 0, 0, 0};
+    std::shared_ptr<ThreadPool> pool;
+    std::vector<TileTiming> tileTimings;
+    int64_t raysTraced = 0;
+    int64_t samplesTaken = 0;
+    ProgressMode progressMode = ProgressMode::Human;
+    double progressInterval = 0.5;
+    int samplesPerPass = 0;
+    double timeBudget = 0;
+    double snapshotInterval = 0;
+    double adaptiveThreshold = 0;
+    int adaptiveMinSamples = 16;
+    int adaptiveMaxSamples = 0;
+    std::string checkpointPath;
+    uint64_t checkpointFingerprint = 0;
+    double checkpointInterval = 60;
+    bool resumeCheckpoint = true;
 };
 
 
 //=========================== inline function definitions ==============================
 
+bool AABB::IsHit(const Vector3& origin, const Vector3& invDir,
+                 double minT, double maxT, double& entryT) const
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        double t0 = (pMin.e[i] - origin.e[i]) * invDir.e[i];
+        double t1 = (pMax.e[i] - origin.e[i]) * invDir.e[i];
+        if (t0 > t1) std::swap(t0, t1);
+        minT = t0 > minT ? t0 : minT;
+        maxT = t1 < maxT ? t1 : maxT;
+        if (minT > maxT) return false;
+    }
+    entryT = minT;
+    return true;
+}
+
 inline double Dot(const Vector3 &vec1, const Vector3 &vec2)
 {
     return vec1.Dot(vec2);
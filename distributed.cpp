@@ -0,0 +1,408 @@
+#include "distributed.h"
+#include "framebuffer.h"
+#include "tile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+// seconds an answer may stall once it started to arrive before its worker counts as dead
+const int ANSWER_TIMEOUT = 10;
+
+// a tile for a worker to render, and its answer in front of the tile's pixels
+struct TaskMessage
+{
+    int32_t task;
+    int32_t reserved;
+    Tile tile;
+};
+
+bool SendAll(int fd, const void* data, size_t size)
+{
+    const char* p = (const char*) data;
+    while (size > 0)
+    {
+        // a closed peer fails the send instead of raising SIGPIPE
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool ReceiveAll(int fd, void* data, size_t size)
+{
+    char* p = (char*) data;
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+size_t TilePixels(const Tile& tile)
+{
+    return (size_t) (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+}
+
+// body of a worker process: render the tiles it is sent until its socket closes
+void WorkerMain(int fd, Camera& camera, Objects& objects, int threads)
+{
+    camera.SetThreads(threads);
+    camera.SetProgress(ProgressMode::Off);
+    camera.SetCheckpoint("", 0);
+    int nx = camera.Width();
+    CachedPPM ppm(nx, camera.Height(), nullptr);
+    FrameBuffer& buffer = ppm.Buffer();
+    TaskMessage message;
+    vector<Pixel> pixels;
+    while (ReceiveAll(fd, &message, sizeof(message)))
+    {
+        const Tile& tile = message.tile;
+        camera.SetRegion(tile);
+        camera.Render(ppm, objects);
+        pixels.resize(TilePixels(tile));
+        Pixel* out = pixels.data();
+        for (int y = tile.y0; y < tile.y1; ++y)
+        {
+            Pixel* row = buffer.Data() + (size_t) y * nx;
+            copy(row + tile.x0, row + tile.x1, out);
+            // samples are numbered from the pixel's count, a tile sent again starts over
+            fill(row + tile.x0, row + tile.x1, Pixel{0, 0, 0, 0});
+            out += tile.x1 - tile.x0;
+        }
+        if (!SendAll(fd, &message, sizeof(message)) ||
+            !SendAll(fd, pixels.data(), pixels.size() * sizeof(Pixel)))
+        {
+            return;
+        }
+    }
+}
+
+class Coordinator
+{
+public:
+    Coordinator(Camera& camera, Objects& objects, CachedPPM& ppm, const DistributedSettings& settings,
+                DistributedStats& stats)
+            : camera(camera), objects(objects), ppm(ppm), settings(settings), stats(stats),
+              progress(settings.progress, 0.5)
+    {
+    }
+
+    bool Run(string& error);
+private:
+    struct Worker
+    {
+        pid_t pid = -1;
+        int fd = -1;            // -1 once the process is gone
+        int task = -1;          // -1 while idle
+        chrono::steady_clock::time_point started;
+    };
+
+    struct Task
+    {
+        Tile tile;
+        int running = 0;        // workers rendering it
+        int attempts = 0;       // workers that died rendering it
+        bool done = false;
+    };
+
+    bool Spawn(int slot);
+    void Dispatch();
+    // a tile to render a second time, -1 if none is slow enough
+    int SlowTask(chrono::steady_clock::time_point now);
+    // read a worker's answer into the frame buffer, false if the worker is gone
+    bool Receive(Worker& worker, int slot);
+    void Died(int slot);
+    void Shutdown();
+
+    Camera& camera;
+    Objects& objects;
+    CachedPPM& ppm;
+    const DistributedSettings& settings;
+    DistributedStats& stats;
+    ProgressTracker progress;
+    int threads = 1;
+    vector<Worker> workers;
+    vector<Task> tasks;
+    deque<int> pending;
+    size_t done = 0;
+    vector<double> seconds;     // render time of every tile done
+    vector<Pixel> scratch;
+    string failure;
+};
+
+bool Coordinator::Run(string& error)
+{
+    int nx = camera.Width(), ny = camera.Height();
+    int count = max(settings.workers, 1);
+    threads = settings.threadsPerWorker > 0
+              ? settings.threadsPerWorker
+              : max(1, (int) thread::hardware_concurrency() / count);
+    int tileSize = settings.tileSize;
+    if (tileSize <= 0)
+    {
+        tileSize = (int) sqrt((double) nx * ny / (8 * count));
+        tileSize = min(max(tileSize, 16), 256);
+    }
+    for (const Tile& tile: MakeTiles(nx, ny, tileSize, TileOrder::Morton))
+    {
+        pending.push_back((int) tasks.size());
+        tasks.push_back(Task());
+        tasks.back().tile = tile;
+    }
+    stats = DistributedStats();
+    stats.tiles = (int) tasks.size();
+    stats.tilesPerWorker.assign(count, 0);
+
+    // built once here, the workers get the BVH with their copy of the process
+    objects.Prepare();
+    workers.resize(count);
+    int started = 0;
+    for (int slot = 0; slot < count; ++slot)
+    {
+        started += Spawn(slot) ? 1 : 0;
+    }
+    if (started == 0)
+    {
+        error = "cannot start worker processes";
+        return false;
+    }
+
+    int64_t samples = camera.SamplesPerPixel();
+    progress.Start((int64_t) nx * ny * samples);
+    vector<pollfd> fds;
+    vector<int> slots;
+    while (done < tasks.size() && failure.empty())
+    {
+        Dispatch();
+        fds.clear();
+        slots.clear();
+        for (int slot = 0; slot < count; ++slot)
+        {
+            if (workers[slot].fd < 0) continue;
+            fds.push_back({workers[slot].fd, POLLIN, 0});
+            slots.push_back(slot);
+        }
+        if (fds.empty())
+        {
+            failure = "no worker processes left";
+            break;
+        }
+        // wake up now and then to look for slow tiles
+        int ready = poll(fds.data(), fds.size(), 100);
+        if (ready < 0 && errno != EINTR)
+        {
+            failure = "poll failed";
+            break;
+        }
+        for (size_t f = 0; f < fds.size() && ready > 0; ++f)
+        {
+            if (!fds[f].revents) continue;
+            Worker& worker = workers[slots[f]];
+            if (!Receive(worker, slots[f]))
+            {
+                Died(slots[f]);
+            }
+        }
+    }
+    progress.Stop();
+    Shutdown();
+    if (!failure.empty())
+    {
+        error = failure;
+        return false;
+    }
+    ppm.WriteToFile();
+    return true;
+}
+
+bool Coordinator::Spawn(int slot)
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return false;
+    // a replacement is forked mid render: no reporter thread may hold a lock the child would inherit
+    progress.Pause();
+    // anything buffered would be written out by the child as well
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid != 0) progress.Resume();
+    if (pid < 0)
+    {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(sockets[0]);
+        // the other workers see their socket close only if no other process holds it
+        for (const Worker& other: workers)
+        {
+            if (other.fd >= 0) close(other.fd);
+        }
+        WorkerMain(sockets[1], camera, objects, threads);
+        // no destructors or exit handlers of the parent's objects
+        _exit(0);
+    }
+    close(sockets[1]);
+    // a worker stopped halfway through its answer must not hang the render
+    timeval timeout{ANSWER_TIMEOUT, 0};
+    setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    Worker& worker = workers[slot];
+    worker.pid = pid;
+    worker.fd = sockets[0];
+    worker.task = -1;
+    return true;
+}
+
+void Coordinator::Dispatch()
+{
+    for (int slot = 0; slot < (int) workers.size() && failure.empty(); ++slot)
+    {
+        Worker& worker = workers[slot];
+        if (worker.fd < 0 || worker.task >= 0) continue;
+        auto now = chrono::steady_clock::now();
+        int task = -1;
+        if (!pending.empty())
+        {
+            task = pending.front();
+            pending.pop_front();
+        }
+        else
+        {
+            task = SlowTask(now);
+            if (task < 0) return;
+            ++stats.duplicates;
+        }
+        worker.task = task;
+        worker.started = now;
+        ++tasks[task].running;
+        TaskMessage message{task, 0, tasks[task].tile};
+        if (!SendAll(worker.fd, &message, sizeof(message)))
+        {
+            Died(slot);
+        }
+    }
+}
+
+int Coordinator::SlowTask(chrono::steady_clock::time_point now)
+{
+    if (seconds.empty()) return -1;
+    vector<double> sorted = seconds;
+    nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    double slow = settings.slowFactor * sorted[sorted.size() / 2];
+    int task = -1;
+    double longest = slow;
+    for (const Worker& worker: workers)
+    {
+        if (worker.fd < 0 || worker.task < 0 || tasks[worker.task].running > 1) continue;
+        double elapsed = chrono::duration<double>(now - worker.started).count();
+        if (elapsed > longest)
+        {
+            longest = elapsed;
+            task = worker.task;
+        }
+    }
+    return task;
+}
+
+bool Coordinator::Receive(Worker& worker, int slot)
+{
+    TaskMessage message;
+    if (!ReceiveAll(worker.fd, &message, sizeof(message)) || message.task != worker.task) return false;
+    Task& task = tasks[worker.task];
+    scratch.resize(TilePixels(task.tile));
+    if (!ReceiveAll(worker.fd, scratch.data(), scratch.size() * sizeof(Pixel))) return false;
+    --task.running;
+    worker.task = -1;
+    // the same tile rendered twice is the same, the second answer is dropped
+    if (task.done) return true;
+    task.done = true;
+    ++done;
+    seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - worker.started).count());
+    ++stats.tilesPerWorker[slot];
+
+    const Tile& tile = task.tile;
+    int nx = camera.Width(), width = tile.x1 - tile.x0;
+    for (int y = tile.y0; y < tile.y1; ++y)
+    {
+        copy_n(&scratch[(size_t) (y - tile.y0) * width], width, ppm.Buffer().Data() + (size_t) y * nx + tile.x0);
+    }
+    progress.Add((int64_t) scratch.size() * camera.SamplesPerPixel());
+    return true;
+}
+
+void Coordinator::Died(int slot)
+{
+    Worker& worker = workers[slot];
+    close(worker.fd);
+    worker.fd = -1;
+    kill(worker.pid, SIGKILL);
+    waitpid(worker.pid, nullptr, 0);
+    worker.pid = -1;
+
+    // an idle worker has no tile to hand on, but is replaced all the same
+    if (worker.task >= 0)
+    {
+        Task& task = tasks[worker.task];
+        worker.task = -1;
+        --task.running;
+        ++stats.deaths;
+        // a tile that kills every worker it is given to would never finish
+        if (!task.done && ++task.attempts >= settings.maxAttempts)
+        {
+            failure = "tile [" + to_string(task.tile.x0) + ", " + to_string(task.tile.x1) + ") x [" +
+                      to_string(task.tile.y0) + ", " + to_string(task.tile.y1) + "): " +
+                      to_string(task.attempts) + " workers died rendering it";
+        }
+        else if (!task.done && task.running == 0)
+        {
+            pending.push_front((int) (&task - tasks.data()));
+        }
+    }
+    if (failure.empty()) Spawn(slot);
+}
+
+void Coordinator::Shutdown()
+{
+    for (Worker& worker: workers)
+    {
+        if (worker.fd < 0) continue;
+        // an idle worker exits once its socket closes, a busy one is still on a tile nobody needs
+        if (worker.task >= 0) kill(worker.pid, SIGKILL);
+        close(worker.fd);
+        worker.fd = -1;
+    }
+    for (Worker& worker: workers)
+    {
+        if (worker.pid > 0) waitpid(worker.pid, nullptr, 0);
+        worker.pid = -1;
+    }
+}
+}
+
+bool RenderDistributed(Camera& camera, Objects& objects, CachedPPM& ppm, const DistributedSettings& settings,
+                       string& error, DistributedStats* stats)
+{
+    DistributedStats local;
+    Coordinator coordinator(camera, objects, ppm, settings, stats ? *stats : local);
+    return coordinator.Run(error);
+}
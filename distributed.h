@@ -0,0 +1,49 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "progress.h"
+
+struct DistributedSettings
+{
+    int workers = 2;                // worker processes
+    int threadsPerWorker = 0;       // <= 0 to share the hardware threads out between the workers
+    int tileSize = 0;               // 0 for about 8 tiles per worker
+    double slowFactor = 4;          // a tile running this many times the median tile time is slow
+    int maxAttempts = 3;            // a tile is given up once this many workers died on it
+    ProgressMode progress = ProgressMode::Human;
+};
+
+/* What happened to the workers in one render */
+struct DistributedStats
+{
+    int tiles = 0;
+    int deaths = 0;                 // workers that died rendering a tile, each replaced by a new one
+    int duplicates = 0;             // slow tiles handed to a second worker
+    std::vector<int> tilesPerWorker;
+};
+
+/**
+ * Render a frame like camera.Render, with worker processes instead of the
+ * threads of this one. The workers are forked from this process, so they
+ * have the scene and its BVH without loading or building anything and
+ * share their memory with it until written. The frame is split into tiles
+ * handed out one at a time over a local socket per worker; a worker
+ * renders its tile with threadsPerWorker threads of its own and sends back
+ * the float accumulation of the tile's pixels, which is copied into ppm's
+ * frame buffer. Samples are numbered per pixel, so the image is the one a
+ * render in one process makes. Adaptive sampling spreads its budget within
+ * each tile instead of the whole image, and a time budget applies per tile.
+ *
+ * A worker that exits or crashes, busy or idle, or stalls halfway through
+ * sending a tile back, has its tile handed to another worker and is
+ * replaced by a new process. Once no tiles are left to hand out, idle
+ * workers also take over tiles that have run slowFactor times as long as
+ * the median tile, the first result to come back is used.
+ *
+ * Call it before the camera has rendered in this process and while no
+ * other threads run: forking copies only the calling thread. False with
+ * error set if no worker could be started or a tile failed maxAttempts times.
+ */
+bool RenderDistributed(Camera& camera, Objects& objects, CachedPPM& ppm, const DistributedSettings& settings,
+                       std::string& error, DistributedStats* stats = nullptr);
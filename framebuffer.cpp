@@ -0,0 +1,40 @@
+#include "framebuffer.h"
+
+#include <algorithm>
+
+using namespace std;
+
+double FrameBuffer::RelativeError(int x, int y) const
+{
+    size_t i = (size_t) y * nx + x;
+    const Pixel& p = pixels[i];
+    if (p.n < 2 || luminanceSq.empty()) return INFINITY;
+    double mean = Luminance(Color(p.r, p.g, p.b)) / p.n;
+    double variance = max(0.0, (luminanceSq[i] - p.n * mean * mean) / (p.n - 1));
+    // the small offset keeps near black pixels from asking for endless samples
+    return sqrt(variance / p.n) / (mean + 0.01);
+}
+
+void FrameBuffer::Tonemap(int y0, int y1, unsigned char* rgb) const
+{
+    for (size_t i = (size_t) y0 * nx; i < (size_t) y1 * nx; ++i, rgb += 3)
+    {
+        const Pixel& p = pixels[i];
+        if (p.n <= 0)
+        {
+            rgb[0] = rgb[1] = rgb[2] = 0;
+            continue;
+        }
+        // gamma 2, then scale colors brighter than white down, keeping their hue
+        float c[3] = {sqrt(max(p.r / p.n, 0.f)) * 255.99f,
+                      sqrt(max(p.g / p.n, 0.f)) * 255.99f,
+                      sqrt(max(p.b / p.n, 0.f)) * 255.99f};
+        float m = max(c[0], max(c[1], c[2]));
+        float scale = m > 255.99f ? 255.99f / m : 1;
+        for (int k = 0; k < 3; ++k)
+        {
+            int v = (int) (c[k] * scale);
+            rgb[k] = (unsigned char) (v > 255 ? 255 : v);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+
+#include <algorithm>
+
+/* Sum of the linear radiance samples of a pixel and their count */
+struct alignas(16) Pixel
+{
+    float r, g, b;
+    float n;
+};
+
+inline double Luminance(const Color& c)
+{
+    return 0.2126 * c.e[0] + 0.7152 * c.e[1] + 0.0722 * c.e[2];
+}
+
+/**
+ * Float32 accumulation buffer. Samples are added in linear space;
+ * tonemapping and quantizing only happen when the image is written out,
+ * so further passes can keep adding samples to the same buffer.
+ */
+class FrameBuffer
+{
+public:
+    FrameBuffer(int nx, int ny) : nx(nx), ny(ny), pixels((size_t) nx * ny, Pixel{0, 0, 0, 0}) { }
+    int Width() const { return nx; }
+    int Height() const { return ny; }
+
+    /* Add the sum of `samples` samples to a pixel, thread-safe for different pixels */
+    void Add(int x, int y, const Color& sum, int samples)
+    {
+        Pixel& p = pixels[(size_t) y * nx + x];
+        p.r += (float) sum.e[0];
+        p.g += (float) sum.e[1];
+        p.b += (float) sum.e[2];
+        p.n += (float) samples;
+    }
+
+    /* Same, also adding the sum of the squared luminances of the samples */
+    void Add(int x, int y, const Color& sum, double luminanceSq, int samples)
+    {
+        Add(x, y, sum, samples);
+        if (!this->luminanceSq.empty())
+        {
+            this->luminanceSq[(size_t) y * nx + x] += (float) luminanceSq;
+        }
+    }
+
+    /* Keep the squared luminances needed by RelativeError() */
+    void TrackVariance() { luminanceSq.assign(pixels.size(), 0); }
+
+    /* Squared luminance sums of the pixels, null unless variance is tracked */
+    float* LuminanceSqData() { return luminanceSq.empty() ? nullptr : luminanceSq.data(); }
+
+    /* Standard error of the mean luminance of a pixel divided by that mean */
+    double RelativeError(int x, int y) const;
+    const Pixel& At(int x, int y) const { return pixels[(size_t) y * nx + x]; }
+    Pixel* Data() { return pixels.data(); }
+    const Pixel* Data() const { return pixels.data(); }
+    size_t Bytes() const { return pixels.size() * sizeof(Pixel); }
+    void Clear()
+    {
+        std::fill(pixels.begin(), pixels.end(), Pixel{0, 0, 0, 0});
+        std::fill(luminanceSq.begin(), luminanceSq.end(), 0.f);
+    }
+
+    /* Tonemap rows [y0, y1) to 8-bit rgb, rgb points at the first pixel of row y0 */
+    void Tonemap(int y0, int y1, unsigned char* rgb) const;
+private:
+    int nx, ny;
+    std::vector<Pixel> pixels;
+    std::vector<float> luminanceSq;
+};
+
@@ -0,0 +1,235 @@
+#include "integrator.h"
+#include "material.h"
+#include "object.h"
+#include "rng.h"
+#include "raypacket.h"
+
+using namespace std;
+
+Glass m{1};
+Sphere sun{{-1, 8, -5}, 3, m};
+
+Color ColorSky(const Ray& r)
+{
+    if (sun.Occluded(r, 0, MAXFLOAT))
+    {
+        return {1, 1, 1};
+    }
+    return ColorSkyGradient(r);
+}
+
+Color ColorSkyGradient(const Ray& r)
+{
+    Vector3 unitDir = r.Direction().UnitVector();
+    auto t = 0.5 * (unitDir[1] + 1.0f);
+    Vector3 result = {((1 - t) * Color(1, 1, 1) + t * Color(0.4, 0.6, 0.9))};
+    return result;
+}
+
+
+Color ColorBalls2(const Ray& r, Objects& os, int depth)
+{
+    HitRecord hr;
+    if (os.IsHit(r, 0, MAXFLOAT, hr))
+    {
+        if (depth > 50) {
+            return {0, 0, 0};
+        };
+        Color c{0, 0, 0};
+        for (auto& scatterInfo: hr.scatterInfos)
+        {
+            c += scatterInfo.attenuation * ColorBalls2(scatterInfo. outRay, os, ++depth);
+        }
+        return c;
+    }
+    else
+    {
+        return ColorSky(r);
+    }
+}
+
+namespace
+{
+// weight of a sample taken with pdf a when b is the pdf of the other strategy
+double PowerHeuristic(double a, double b)
+{
+    return a * a / (a * a + b * b);
+}
+}
+
+Color PathTracer::operator()(const Ray& r, Objects& os, int depth) const
+{
+    if (depth >= maxDepth) return {0, 0, 0};
+    Hit hit;
+    // a miss leaves hit.object at -1
+    os.Intersect(r, 0, MAXFLOAT, hit);
+    return Trace(r, hit, os, depth);
+}
+
+Color PathTracer::operator()(const RayPacket& packet, int ray, Objects& os) const
+{
+    if (maxDepth <= 0) return {0, 0, 0};
+    return Trace(packet.rays[ray], {packet.tMax[ray], packet.object[ray]}, os, 0);
+}
+
+bool NextBounce(const HitRecord& hr, int depth, int rouletteDepth, Vector3& throughput, Ray& ray)
+{
+    int n = hr.scatterInfos.size();
+    if (n == 0)
+    {
+        // absorbed
+        return false;
+    }
+
+    // pick one of the scattered rays, keep the estimate unbiased by dividing by its probability
+    double total = 0;
+    for (auto& scatterInfo: hr.scatterInfos)
+    {
+        total += scatterInfo.weight;
+    }
+    int chosen = n - 1;
+    double probability = 1.0 / n;
+    if (total > 0)
+    {
+        double pick = RandomDouble() * total;
+        for (int i = 0; i < n; ++i)
+        {
+            pick -= hr.scatterInfos[i].weight;
+            if (pick < 0 && hr.scatterInfos[i].weight > 0)
+            {
+                chosen = i;
+                break;
+            }
+        }
+        probability = hr.scatterInfos[chosen].weight / total;
+    }
+    else
+    {
+        chosen = (int) (RandomDouble() * n) % n;
+    }
+    const ScatterInfo& scatterInfo = hr.scatterInfos[chosen];
+    throughput = throughput * scatterInfo.attenuation / probability;
+    ray = scatterInfo.outRay;
+
+    if (depth + 1 >= rouletteDepth)
+    {
+        double q = max(throughput.e[0], max(throughput.e[1], throughput.e[2]));
+        q = min(q, 0.95);
+        if (RandomDouble() >= q)
+        {
+            return false;
+        }
+        throughput /= q;
+    }
+    return true;
+}
+
+double PathTracer::LightPickPdf(const Objects& os) const
+{
+    int count = (int) os.Lights().size() + (sampleEnvironment ? 1 : 0);
+    return count > 0 ? 1.0 / count : 0;
+}
+
+Color PathTracer::SampleLight(const Ray& r, const HitRecord& hr, const MaterialRecord& m, Objects& os) const
+{
+    const vector<int>& lights = os.Lights();
+    int count = (int) lights.size() + (sampleEnvironment ? 1 : 0);
+    if (count == 0) return {0, 0, 0};
+    int pick = min((int) (SampleDouble() * count), count - 1);
+    double u1, u2;
+    Sample2D(u1, u2);
+
+    Vector3 dir;
+    double lightPdf;
+    Color emitted;
+    if (pick < (int) lights.size())
+    {
+        auto* light = static_cast<Sphere*>(os.Get(lights[pick]));
+        if (!light->SampleSolidAngle(hr.p, u1, u2, dir, lightPdf)) return {0, 0, 0};
+        Ray shadow(hr.p, dir);
+        HitRecord lightHit;
+        if (!light->IsHit(shadow, 0, MAXFLOAT, lightHit)) return {0, 0, 0};
+        // anything in front of the light blocks it
+        if (os.Occluded(shadow, 0, lightHit.t * (1 - 1e-9))) return {0, 0, 0};
+        emitted = EmittedBy(os.MaterialAt(lights[pick]));
+    }
+    else
+    {
+        // uniform over the sphere of directions
+        dir = SampleSphere(u1, u2);
+        lightPdf = 1 / (4 * M_PI);
+        Ray shadow(hr.p, dir);
+        if (os.Occluded(shadow, 0, MAXFLOAT)) return {0, 0, 0};
+        emitted = background(shadow);
+    }
+
+    Color f;
+    double bsdfPdf;
+    EvaluateBy(m, r, hr, dir, f, bsdfPdf);
+    if (bsdfPdf <= 0) return {0, 0, 0};
+    lightPdf /= count;
+    return f * emitted * (PowerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+}
+
+Color PathTracer::Trace(const Ray& r, Hit hit, Objects& os, int depth) const
+{
+    Color radiance{0, 0, 0};
+    Vector3 throughput{1, 1, 1};
+    Ray ray = r;
+    HitRecord hr;
+    // pdf of the scattered ray being followed and where it started, 0 after
+    // a discrete (mirror, glass) bounce which light sampling can't reproduce
+    double bsdfPdf = 0;
+    Vector3 from;
+    for (; depth < maxDepth; ++depth)
+    {
+        if (hit.object < 0)
+        {
+            Color sky = background(ray);
+            double weight = 1;
+            if (lightSampling && sampleEnvironment && bsdfPdf > 0)
+            {
+                weight = PowerHeuristic(bsdfPdf, LightPickPdf(os) / (4 * M_PI));
+            }
+            radiance += throughput * sky * weight;
+            break;
+        }
+        hr.scatterInfos.clear();
+        os.Shade(ray, hit, 0, hr);
+        const MaterialRecord& m = os.MaterialAt(hit.object);
+        Color emitted = EmittedBy(m);
+        if (!IsBlack(emitted))
+        {
+            double weight = 1;
+            auto* light = lightSampling && bsdfPdf > 0 ? dynamic_cast<Sphere*>(os.Get(hit.object)) : nullptr;
+            if (light)
+            {
+                weight = PowerHeuristic(bsdfPdf, LightPickPdf(os) * light->SolidAnglePdf(from));
+            }
+            radiance += throughput * emitted * weight;
+        }
+        bool diffuse = lightSampling && DiffuseBy(m);
+        if (diffuse)
+        {
+            radiance += throughput * SampleLight(ray, hr, m, os);
+        }
+
+        Ray in = ray;
+        if (!NextBounce(hr, depth, rouletteDepth, throughput, ray))
+        {
+            break;
+        }
+        bsdfPdf = 0;
+        if (diffuse)
+        {
+            Color f;
+            EvaluateBy(m, in, hr, ray.Direction(), f, bsdfPdf);
+            from = hr.p;
+        }
+        if (depth + 1 < maxDepth)
+        {
+            os.Intersect(ray, 0, MAXFLOAT, hit);
+        }
+    }
+    return radiance;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+
+/*
+ * Color of a ray that leaves the scene.
+ */
+typedef std::function<Color(const Ray&)> BackgroundHandler;
+
+/* Sky gradient with a white sun sphere in it */
+Color ColorSky(const Ray& r);
+
+/* ColorSky without the sun, for scenes that have the sun as an emissive sphere */
+Color ColorSkyGradient(const Ray& r);
+
+/*
+ * One bounce of a path at the hit hr: follows one of the scattered rays,
+ * picked in proportion to its weight, and from rouletteDepth on applies
+ * russian roulette. Updates the throughput and ray, returns false if the
+ * path ends here.
+ */
+bool NextBounce(const HitRecord& hr, int depth, int rouletteDepth, Vector3& throughput, Ray& ray);
+
+/*
+ * Recursive color handler, follows every scattered ray.
+ */
+Color ColorBalls2(const Ray& r, Objects& os, int depth = 0);
+
+/**
+ * Iterative path tracer. Only one scattered ray is followed per bounce,
+ * picked in proportion to ScatterInfo::weight (fresnel for glass),
+ * so the cost of a sample stays linear in the path length.
+ * Paths end at the max depth or by russian roulette.
+ * With light sampling on, every diffuse hit also samples a light
+ * (an emissive sphere or the background) directly, combined with the
+ * scattered rays that hit lights by multiple importance sampling.
+ * Can be used directly as a ColorHandler.
+ */
+class PathTracer
+{
+public:
+    explicit PathTracer(const BackgroundHandler& background) : background(background) { }
+    void SetMaxDepth(int depth) { maxDepth = depth; }
+
+    /* Number of bounces before russian roulette may end a path */
+    void SetRouletteDepth(int depth) { rouletteDepth = depth; }
+
+    /* Next event estimation toward Objects::Lights(), and the background if environment is set */
+    void SetLightSampling(bool enabled, bool environment = true)
+    {
+        lightSampling = enabled;
+        sampleEnvironment = environment;
+    }
+    Color operator()(const Ray& r, Objects& os, int depth) const;
+
+    /* Packet version, can be used as a PacketColorHandler */
+    Color operator()(const RayPacket& packet, int ray, Objects& os) const;
+protected:
+    // follow the path on from the first hit of r, hit.object is -1 for a miss
+    Color Trace(const Ray& r, Hit hit, Objects& os, int depth) const;
+    // radiance from one light sampled at a diffuse hit, MIS weighted
+    Color SampleLight(const Ray& r, const HitRecord& hr, const MaterialRecord& m, Objects& os) const;
+    // probability of picking each light, the background included
+    double LightPickPdf(const Objects& os) const;
+
+    BackgroundHandler background;
+    int maxDepth = 50;
+    int rouletteDepth = 3;
+    bool lightSampling = false;
+    bool sampleEnvironment = true;
+};
@@ -11,25 +11,14 @@
 #include "object.h"
 #include "common.h"
 #include "material.h"
+#include "integrator.h"
+#include "rng.h"
+#include "scene.h"
+#include "distributed.h"
 
-using namespace std;
-
-Glass m{1};
-Sphere sun{{-1, 8, -5}, 3, m};
-
-Color ColorSky(const Ray& r)
-{
-    HitRecord hr;
-    if (sun.IsHit(r, 0, MAXFLOAT, hr))
-    {
-        return {1, 1, 1};
-    }
-    Vector3 unitDir = r.Direction().UnitVector();
-    auto t = 0.5 * (unitDir[1] + 1.0f);
-    Vector3 result = {((1 - t) * Color(1, 1, 1) + t * Color(0.4, 0.6, 0.9))};
-    return result;
-}
+#include <cstring>
 
+using namespace std;
 
 int RenderSky(int nx, int ny, Color* buffer, const char* filePath)
 {
@@ -56,80 +45,196 @@ int RenderSky(int nx, int ny, Color* buffer, const char* filePath)
 }
 
 
-Color ColorBalls2(const Ray& r, Objects& os, int depth = 0)
+/* Path of one frame of a sequence: the frame number goes before the extension */
+string FramePath(const char* filePath, int frame)
+{
+    string path = filePath;
+    char number[16];
+    snprintf(number, sizeof(number), "_%04d", frame);
+    size_t dot = path.rfind('.');
+    if (dot == string::npos || path.find('/', dot) != string::npos) return path + number;
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+/*
+ * Render every frame of an animated scene. The scene, its BVH, the render
+ * threads and the frame buffer are set up once; a frame only moves the
+ * camera and the moving spheres and refits the BVH to them, which is
+ * timed apart from tracing the frame.
+ */
+int RenderSequence(const Scene& scene, Camera& camera, Objects& objects, const char* filePath, int workers)
 {
-    HitRecord hr;
-    if (os.IsHit(r, 0, MAXFLOAT, hr))
+    const RenderSettings& settings = scene.Settings();
+    camera.SetProgress(ProgressMode::Off);
+    CachedPPM ppm(settings.nx, settings.ny, nullptr);
+    // the ppm keeps only a pointer to its path, so the paths live as long as the ppm
+    vector<string> paths;
+    for (int frame = 0; frame < settings.frames; ++frame) paths.push_back(FramePath(filePath, frame));
+    double setupTotal = 0, traceTotal = 0;
+    for (int frame = 0; frame < settings.frames; ++frame)
     {
-        if (depth > 50) {
-            if (r.refracted)
+        auto start = chrono::steady_clock::now();
+        Vector3 lookFrom, lookAt, vup;
+        scene.FrameView(frame, lookFrom, lookAt, vup);
+        double focus = settings.focusDist > 0 ? settings.focusDist : (lookAt - lookFrom).Length();
+        camera.SetView(lookFrom, lookAt, vup, settings.vfov, settings.aperture, focus);
+        camera.SetFrame(frame);
+        scene.Pose(objects, frame);
+        objects.Prepare();
+        const string& path = paths[frame];
+        ppm.Reset(path.c_str());
+        auto traceStart = chrono::steady_clock::now();
+        if (workers > 0)
+        {
+            DistributedSettings distributed;
+            distributed.workers = workers;
+            distributed.progress = ProgressMode::Off;
+            string error;
+            if (!RenderDistributed(camera, objects, ppm, distributed, error))
             {
-                bool a = r.refracted;
+                fprintf(stderr, "%s\n", error.c_str());
+                return 1;
             }
-            return {0, 0, 0};
-        };
-        Color c{0, 0, 0};
-        for (auto& scatterInfo: hr.scatterInfos)
+        }
+        else
         {
-            c += scatterInfo.attenuation * ColorBalls2(scatterInfo. outRay, os, ++depth);
+            camera.Render(ppm, objects);
         }
-        return c;
+        auto end = chrono::steady_clock::now();
+        double setup = chrono::duration<double, milli>(traceStart - start).count();
+        double trace = chrono::duration<double, milli>(end - traceStart).count();
+        printf("%s: setup %.2f ms, trace %.1f ms\n", path.c_str(), setup, trace);
+        setupTotal += setup;
+        traceTotal += trace;
+    }
+    printf("%d frames, per frame: setup %.2f ms, trace %.1f ms\n", settings.frames,
+           setupTotal / settings.frames, traceTotal / settings.frames);
+    return 0;
+}
+
+int RenderScene(const Scene& scene, const char* filePath, const char* checkpoint, double checkpointInterval,
+                int workers)
+{
+    const RenderSettings& settings = scene.Settings();
+    Vector3 lookFrom(settings.lookFrom[0], settings.lookFrom[1], settings.lookFrom[2]);
+    Vector3 lookAt(settings.lookAt[0], settings.lookAt[1], settings.lookAt[2]);
+    Vector3 vup(settings.vup[0], settings.vup[1], settings.vup[2]);
+    double focus = settings.focusDist > 0 ? settings.focusDist : (lookAt - lookFrom).Length();
+    Camera camera(lookFrom, lookAt, vup, settings.vfov, settings.aperture, focus, settings.nx, settings.ny);
+
+    auto start = chrono::steady_clock::now();
+    Objects objects;
+    string error;
+    if (!scene.Build(objects, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    objects.Prepare();
+    printf("scene of %d objects ready in %.1f ms\n", objects.Size(),
+           chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+
+    PathTracer tracer(settings.sunSky ? ColorSky : ColorSkyGradient);
+    tracer.SetMaxDepth(settings.maxDepth);
+    tracer.SetLightSampling(settings.lightSampling != 0);
+    camera.SetColorHandler(tracer);
+    camera.SetPacketHandler(tracer, 8);
+    camera.SetAntiAliasing(true);
+    camera.SetAaSamples(settings.samples);
+    camera.SetSampler((SamplerType) settings.sampler);
+    if (settings.frames > 1)
+    {
+        return RenderSequence(scene, camera, objects, filePath, workers);
+    }
+    if (checkpoint)
+    {
+        camera.SetCheckpoint(checkpoint, scene.Fingerprint(), checkpointInterval);
+    }
+    CachedPPM ppm(settings.nx, settings.ny, filePath);
+    if (workers > 0)
+    {
+        DistributedSettings distributed;
+        distributed.workers = workers;
+        DistributedStats stats;
+        if (!RenderDistributed(camera, objects, ppm, distributed, error, &stats))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        printf("%d tiles on %d workers, %d workers died, %d slow tiles rendered twice\n", stats.tiles, workers,
+               stats.deaths, stats.duplicates);
     }
     else
     {
-        return ColorSky(r);
+        camera.Render(ppm, objects);
     }
+    objects.Memory().Print();
+    return 0;
 }
 
-
-int DrawBalls(const char *filePath, int nx, int ny)
+int main(int argc, char** argv)
 {
-    // Init camera
-    Vector3 lookFrom{-5, 0.2, -5};
-    Vector3 lookAt{0, 0, -1};
-    double focus = (lookAt - lookFrom).Length();
-    float aperture = 0.2;
-    Camera camera(lookFrom, lookAt, {0, 1, 0}, 20, aperture, focus,
-                  nx, ny);
-
-    // generate balls
-    Objects objects;
-    Lambertian m1({0.6, 0.6, 0.8});
-    Lambertian m2({0.8, 0.5, 0.5});
-    Metal m3({0.8, 0.6, 0.2});
-    Glass m4(1.5); Glass m5(1 / 1.9);
-    Object *sp1 = new Sphere({0, 0, -1}, 0.5, m4);
-    Object *sp2 = new Sphere({0, -1000.5f, -1}, 1000, m1);
-    Object *sp3 = new Sphere({1, 0, -1}, 0.5, m2);
-    Object *sp4 = new Sphere({-1, 0, -1}, 0.5, m3);
-    Object *sp5 = new Sphere({-1, 0, -1}, 0.45, m5);
-    objects.Add(sp1);
-    objects.Add(sp2);
-    objects.Add(sp3);
-    objects.Add(sp4);
+    const char* scenePath = nullptr;
+    const char* output = nullptr;
+    const char* cachePath = nullptr;
+    const char* checkpoint = nullptr;
+    double checkpointInterval = 60;
+    int workers = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if ((arg == "-o" || arg == "--output") && i + 1 < argc) output = argv[++i];
+        else if (arg == "--compile" && i + 1 < argc) cachePath = argv[++i];
+        else if (arg == "--checkpoint" && i + 1 < argc) checkpoint = argv[++i];
+        else if (arg == "--checkpoint-interval" && i + 1 < argc) checkpointInterval = atof(argv[++i]);
+        else if (arg == "--workers" && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (arg[0] != '-' && !scenePath) scenePath = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [scene file or cache] [-o image.ppm] [--compile cache]\n"
+                            "          [--checkpoint file [--checkpoint-interval seconds]] [--workers n]\n"
+                            "  without a scene the built-in balls scene is rendered\n"
+                            "  --compile writes the scene to a binary cache instead of rendering it\n"
+                            "  --checkpoint saves the render every 60 s or the given interval, and\n"
+                            "    resumes from the file if it is there\n"
+                            "  --workers renders with n worker processes, sharing the tiles of the frame,\n"
+                            "    without checkpoints\n"
+                            "  scenes of several frames are written to image_0000.ppm, image_0001.ppm, ...\n"
+                            "    without checkpoints either\n", argv[0]);
+            return 1;
+        }
+    }
+    if (workers > 0 && checkpoint)
+    {
+        // the workers' tiles are not checkpointed, the render would silently have no crash safety
+        fprintf(stderr, "--checkpoint cannot be used with --workers\n");
+        return 1;
+    }
 
-    for (int i = 0; i < 100; ++i)
+    Scene scene;
+    string error;
+    if (!scenePath) BallsScene(scene);
+    else if (!scene.Load(scenePath, error))
     {
-        Material *m = NULL;
-        double mrand = drand48();
-        if (0 <= mrand && mrand < 0.33) m = new Lambertian{{drand48(), drand48(), drand48()}};
-        else if (0.33 <= mrand && mrand < 0.66) m = new Glass(1 + drand48());
-        else m = new Metal({drand48(), drand48(), drand48()});
-        Object *tmp = new Sphere({drand48() * 10 - 5, -0.3, drand48() * 10 - 5}, 0.2, *m);
-        objects.Add(tmp);
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
     }
 
-    // configure camera
-    camera.SetColorHandler(ColorBalls2);
-    camera.SetAntiAliasing(true);
-    camera.SetAaSamples(100);
-    CachedPPM ppm(nx, ny, filePath);
-    camera.Render(ppm, objects);
+    if (cachePath)
+    {
+        if (!scene.SaveBinary(cachePath, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        return 0;
+    }
+    if (scene.Settings().frames > 1 && checkpoint)
+    {
+        // frames are not checkpointed, as with --workers
+        fprintf(stderr, "--checkpoint cannot be used with a scene of several frames\n");
+        return 1;
+    }
+    return RenderScene(scene, output ? output : scene.Settings().output, checkpoint, checkpointInterval,
+                       workers);
 }
-
-int main()
-{
-    const int nx = 1920, ny = 1080;
-    DrawBalls("/mnt/c/Users/qwertysun/Desktop/balls.ppm", nx, ny);
-    return 0;
-}
\ No newline at end of file
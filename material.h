@@ -6,6 +6,7 @@
 
 #include "stdafx.h"
 #include "common.h"
+#include "rng.h"
 
 class Lambertian : public Material
 {
@@ -13,6 +14,10 @@ public:
     Lambertian(const Vector3& attenuation) : attenuation(attenuation) { }
     bool Scatter(
             const Ray& r, HitRecord& hr) const override;
+    MaterialKind Kind() const override { return MaterialKind::Lambertian; }
+    MaterialRecord Record() const override { return {MaterialKind::Lambertian, attenuation, 0, this}; }
+    bool Diffuse() const override { return true; }
+    void Evaluate(const Ray& r, const HitRecord& hr, const Vector3& dir, Color& f, double& pdf) const override;
 
 protected:
     Vector3 attenuation;
@@ -24,6 +29,8 @@ public:
     Metal(const Vector3& attenuation) : attenuation(attenuation) { }
     bool Scatter(
             const Ray& r, HitRecord& hr) const override;
+    MaterialKind Kind() const override { return MaterialKind::Metal; }
+    MaterialRecord Record() const override { return {MaterialKind::Metal, attenuation, 0, this}; }
 protected:
     Vector3 attenuation;
 };
@@ -34,6 +41,153 @@ public:
     Glass(double r) : r(r) { }
     bool Scatter(
             const Ray& r, HitRecord& hr) const override;
+    MaterialKind Kind() const override { return MaterialKind::Glass; }
+    MaterialRecord Record() const override { return {MaterialKind::Glass, {1, 1, 1}, r, this}; }
 protected:
     double r; // relative refractive index
-};
\ No newline at end of file
+};
+
+/* Light source, emits radiance and scatters nothing */
+class Emissive : public Material
+{
+public:
+    Emissive(const Color& radiance) : radiance(radiance) { }
+    bool Scatter(
+            const Ray& r, HitRecord& hr) const override { hr.scatterInfos.clear(); return false; }
+    MaterialKind Kind() const override { return MaterialKind::Emissive; }
+    MaterialRecord Record() const override { return {MaterialKind::Emissive, radiance, 0, this}; }
+    Color Emitted() const override { return radiance; }
+protected:
+    Color radiance;
+};
+
+//=========================== material kernels ==============================
+//
+// The shading code of the built-in materials, on MaterialRecords. A kernel
+// is picked at compile time by the kind (ScatterAs<K>) or by a switch on the
+// record (ScatterBy), either way it is inlined into the caller. The virtual
+// functions of the material classes above go through the same kernels.
+
+inline bool IsBlack(const Color& c)
+{
+    return c.e[0] <= 0 && c.e[1] <= 0 && c.e[2] <= 0;
+}
+
+// Schlick's approximation of the fresnel reflectance when entering a medium
+inline double Schlick(const Vector3& income, const Vector3& n, double r)
+{
+    double cosine = -income.Dot(n) / income.Length() / n.Length();
+    double r0 = (1 - r) / (1 + r);
+    r0 = r0 * r0;
+    return r0 + (1 - r0) * pow(1 - cosine, 5);
+}
+
+template <MaterialKind K>
+inline bool ScatterAs(const MaterialRecord& m, const Ray& r, HitRecord& hr)
+{
+    return m.material->Scatter(r, hr);
+}
+
+template <>
+inline bool ScatterAs<MaterialKind::Lambertian>(const MaterialRecord& m, const Ray& r, HitRecord& hr)
+{
+    // a point on the unit sphere around the tip of the normal gives a cosine distributed direction
+    double u1, u2;
+    Sample2D(u1, u2);
+    Vector3 dir = hr.normal + SampleSphere(u1, u2);
+    hr.scatterInfos.push_back({
+                                m.color,
+                                Ray(hr.p, dir),
+                                1
+                              });
+    return true;
+}
+
+template <>
+inline bool ScatterAs<MaterialKind::Metal>(const MaterialRecord& m, const Ray& r, HitRecord& hr)
+{
+    Vector3 dir = Reflect(r.Direction(), hr.normal);
+    hr.scatterInfos.push_back({
+            m.color,
+            Ray(hr.p, dir),
+            1
+    });
+    return true;
+}
+
+template <>
+inline bool ScatterAs<MaterialKind::Glass>(const MaterialRecord& m, const Ray& r, HitRecord& hr)
+{
+    // refraction needs the outward normal to tell entering from leaving
+    Vector3 normal = hr.backFace ? -hr.normal : hr.normal;
+    bool fromOut = r.Direction().Dot(normal) < 0;
+    double reflectance = fromOut ? Schlick(r.Direction(), normal, m.ior) : 0;
+    Vector3 dir1 = Refrect(r.Direction(), normal, m.ior);
+    Ray sr(hr.p, dir1, r);
+    sr.refracted = true;
+    hr.scatterInfos.push_back({
+        m.color,
+        sr,
+        1 - reflectance
+    });
+
+    if (fromOut)
+    {
+        Vector3 dir2 = Reflect(r.Direction(), normal);
+        Ray sr2(hr.p, dir2, r);
+        hr.scatterInfos.push_back({
+             {0.2, 0.2, 0.2},
+             sr2,
+             reflectance
+        });
+    }
+    return true;
+}
+
+template <>
+inline bool ScatterAs<MaterialKind::Emissive>(const MaterialRecord& m, const Ray& r, HitRecord& hr)
+{
+    hr.scatterInfos.clear();
+    return false;
+}
+
+inline bool ScatterBy(const MaterialRecord& m, const Ray& r, HitRecord& hr)
+{
+    switch (m.kind)
+    {
+    case MaterialKind::Lambertian: return ScatterAs<MaterialKind::Lambertian>(m, r, hr);
+    case MaterialKind::Metal: return ScatterAs<MaterialKind::Metal>(m, r, hr);
+    case MaterialKind::Glass: return ScatterAs<MaterialKind::Glass>(m, r, hr);
+    case MaterialKind::Emissive: return ScatterAs<MaterialKind::Emissive>(m, r, hr);
+    default: return m.material->Scatter(r, hr);
+    }
+}
+
+inline Color EmittedBy(const MaterialRecord& m)
+{
+    switch (m.kind)
+    {
+    case MaterialKind::Emissive: return m.color;
+    case MaterialKind::Other: return m.material->Emitted();
+    default: return {0, 0, 0};
+    }
+}
+
+/* Whether EvaluateBy works for the material, see Material::Diffuse */
+inline bool DiffuseBy(const MaterialRecord& m)
+{
+    return m.kind == MaterialKind::Lambertian || (m.kind == MaterialKind::Other && m.material->Diffuse());
+}
+
+inline void EvaluateBy(const MaterialRecord& m, const Ray& r, const HitRecord& hr, const Vector3& dir,
+                       Color& f, double& pdf)
+{
+    if (m.kind != MaterialKind::Lambertian)
+    {
+        m.material->Evaluate(r, hr, dir, f, pdf);
+        return;
+    }
+    double cosine = std::max(0.0, dir.Dot(hr.normal) / dir.Length());
+    pdf = cosine / M_PI;
+    f = m.color * pdf;
+}
@@ -0,0 +1,798 @@
+#include "meshloader.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+// text files are split into about this many bytes per block, binary faces into this many faces
+const size_t BLOCK_BYTES = 1 << 20;
+const int64_t BLOCK_FACES = 1 << 16;
+
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+        if (data) munmap((void*) data, size);
+    }
+
+    bool Open(const char* path, string& error)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            error = string(path) + ": cannot open";
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0)
+        {
+            close(fd);
+            error = string(path) + ": empty";
+            return false;
+        }
+        void* p = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+        {
+            error = string(path) + ": cannot map";
+            return false;
+        }
+        data = (const char*) p;
+        size = (size_t) st.st_size;
+        madvise(p, size, MADV_WILLNEED);
+        return true;
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+// first error of a parallel parse, the one nearest the start of the file wins
+class Errors
+{
+public:
+    void Report(size_t offset, const string& message)
+    {
+        lock_guard<mutex> lock(m);
+        if (offset < first)
+        {
+            first = offset;
+            this->message = message;
+        }
+    }
+
+    bool Any() const { return first != SIZE_MAX; }
+
+    // message prefixed with path and line, counted up to the error's offset
+    string Describe(const char* path, const char* data, bool text) const
+    {
+        string where = string(path) + ":";
+        if (text) where += to_string(count(data, data + first, '\n') + 1) + ":";
+        else where += " byte " + to_string(first) + ":";
+        return where + " " + message;
+    }
+private:
+    mutex m;
+    size_t first = SIZE_MAX;
+    string message;
+};
+
+inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void SkipBlanks(const char*& p, const char* end)
+{
+    while (p < end && IsBlank(*p)) ++p;
+}
+
+inline void SkipToken(const char*& p, const char* end)
+{
+    while (p < end && !IsBlank(*p)) ++p;
+}
+
+bool ParseInt(const char*& p, const char* end, int64_t& x)
+{
+    SkipBlanks(p, end);
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) ++p;
+    if (p == end || *p < '0' || *p > '9') return false;
+    x = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (x > (INT64_MAX - 9) / 10) return false;
+        x = x * 10 + (*p++ - '0');
+    }
+    if (negative) x = -x;
+    return true;
+}
+
+// decimal floating point with an optional exponent, plenty for float positions
+bool ParseFloat(const char*& p, const char* end, float& x)
+{
+    SkipBlanks(p, end);
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) ++p;
+    double mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        mantissa = mantissa * 10 + (*p++ - '0');
+        digits = true;
+    }
+    if (p < end && *p == '.')
+    {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            mantissa = mantissa * 10 + (*p++ - '0');
+            --exponent;
+            digits = true;
+        }
+    }
+    if (!digits) return false;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        int64_t e;
+        if (!ParseInt(p, end, e) || e > 400 || e < -400) return false;
+        exponent += (int) e;
+    }
+    // powers of ten up to 1e22 are exact doubles
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    double scale = abs(exponent) <= 22 ? powers[abs(exponent)] : pow(10.0, abs(exponent));
+    double value = exponent >= 0 ? mantissa * scale : mantissa / scale;
+    x = (float) (negative ? -value : value);
+    return true;
+}
+
+/*
+ * Text formats: the file is split into blocks of whole lines. count(line,
+ * eol, lineNumber, block) adds a line's vertices and triangles to the
+ * block, parse(line, eol, lineNumber, cursor) writes them at the cursor.
+ * Line numbers are only known if the blocks' first lines were counted.
+ */
+struct Block
+{
+    const char* begin;
+    const char* end;
+    int64_t firstLine = 0;
+    int64_t vertices = 0, triangles = 0;
+};
+
+// where a block writes its vertices and triangles
+struct Cursor
+{
+    float* position;
+    uint32_t* index;
+    int64_t vertex;         // index of the next vertex, for relative OBJ indices
+    int64_t vertexCount;    // of the whole mesh, to check the indices
+};
+
+vector<Block> SplitLines(const char* begin, const char* end)
+{
+    vector<Block> blocks;
+    while (begin < end)
+    {
+        const char* stop = end;
+        if ((size_t) (end - begin) > BLOCK_BYTES)
+        {
+            const char* eol = (const char*) memchr(begin + BLOCK_BYTES, '\n', end - begin - BLOCK_BYTES);
+            stop = eol ? eol + 1 : end;
+        }
+        Block b;
+        b.begin = begin;
+        b.end = stop;
+        blocks.push_back(b);
+        begin = stop;
+    }
+    return blocks;
+}
+
+template <class F>
+void ForEachLine(const Block& block, F&& f)
+{
+    int64_t line = block.firstLine;
+    for (const char* p = block.begin; p < block.end; ++line)
+    {
+        const char* eol = (const char*) memchr(p, '\n', block.end - p);
+        if (!eol) eol = block.end;
+        f(p, eol, line);
+        p = eol + 1;
+    }
+}
+
+template <class Count, class Parse>
+void LoadLines(ThreadPool& pool, vector<Block>& blocks, TriangleMesh& mesh, Count&& count, Parse&& parse)
+{
+    pool.ParallelFor((int) blocks.size(), [&](int i, int) {
+        ForEachLine(blocks[i], [&](const char* p, const char* eol, int64_t line) { count(p, eol, line, blocks[i]); });
+    });
+    // block counts become offsets into the mesh buffers
+    int64_t vertices = 0, triangles = 0;
+    for (Block& b: blocks)
+    {
+        swap(vertices, b.vertices);
+        swap(triangles, b.triangles);
+        vertices += b.vertices;
+        triangles += b.triangles;
+    }
+    mesh.positions.resize(3 * vertices);
+    mesh.indices.resize(3 * triangles);
+    pool.ParallelFor((int) blocks.size(), [&](int i, int) {
+        Cursor c = {mesh.positions.data() + 3 * blocks[i].vertices, mesh.indices.data() + 3 * blocks[i].triangles,
+                    blocks[i].vertices, vertices};
+        ForEachLine(blocks[i], [&](const char* p, const char* eol, int64_t line) { parse(p, eol, line, c); });
+    });
+}
+
+// emit the fan of a polygon, one vertex at a time
+class Fan
+{
+public:
+    Fan(Cursor& c) : c(c) { }
+    void Add(uint32_t v)
+    {
+        if (n >= 2)
+        {
+            c.index[0] = first;
+            c.index[1] = previous;
+            c.index[2] = v;
+            c.index += 3;
+        }
+        if (n == 0) first = v;
+        previous = v;
+        ++n;
+    }
+private:
+    Cursor& c;
+    uint32_t first = 0, previous = 0;
+    int n = 0;
+};
+
+//=========================== OBJ ==============================
+
+inline bool IsStatement(const char* p, const char* eol, char c)
+{
+    return eol - p >= 2 && p[0] == c && IsBlank(p[1]);
+}
+
+bool LoadObj(const MappedFile& file, ThreadPool& pool, TriangleMesh& mesh, Errors& errors)
+{
+    vector<Block> blocks = SplitLines(file.data, file.data + file.size);
+    auto count = [](const char* p, const char* eol, int64_t, Block& b) {
+        SkipBlanks(p, eol);
+        if (IsStatement(p, eol, 'v'))
+        {
+            ++b.vertices;
+        }
+        else if (IsStatement(p, eol, 'f'))
+        {
+            int corners = 0;
+            for (++p, SkipBlanks(p, eol); p < eol; SkipBlanks(p, eol))
+            {
+                SkipToken(p, eol);
+                ++corners;
+            }
+            b.triangles += max(corners - 2, 0);
+        }
+    };
+    auto parse = [&](const char* p, const char* eol, int64_t, Cursor& c) {
+        const char* line = p;
+        SkipBlanks(p, eol);
+        if (IsStatement(p, eol, 'v'))
+        {
+            ++p;
+            if (!ParseFloat(p, eol, c.position[0]) || !ParseFloat(p, eol, c.position[1]) ||
+                !ParseFloat(p, eol, c.position[2]))
+            {
+                errors.Report(line - file.data, "bad vertex");
+                c.position[0] = c.position[1] = c.position[2] = 0;
+            }
+            c.position += 3;
+            ++c.vertex;
+        }
+        else if (IsStatement(p, eol, 'f'))
+        {
+            ++p;
+            Fan fan(c);
+            uint32_t* start = c.index;
+            int corners = 0;
+            for (SkipBlanks(p, eol); p < eol; SkipBlanks(p, eol), ++corners)
+            {
+                int64_t v = 0;
+                const char* token = p;
+                bool ok = ParseInt(p, eol, v) && v != 0;
+                // positive indices count from 1, negative ones back from the last vertex so far
+                v = v > 0 ? v - 1 : c.vertex + v;
+                // texture and normal indices after the slashes are unused, but 0 is just as invalid there
+                while (ok && p < eol && *p == '/')
+                {
+                    int64_t other;
+                    ++p;
+                    if (p < eol && !IsBlank(*p) && *p != '/') ok = ParseInt(p, eol, other) && other != 0;
+                }
+                if (!ok || v < 0 || v >= c.vertexCount)
+                {
+                    errors.Report(token - file.data, "bad face index");
+                    v = 0;
+                }
+                SkipToken(p, eol);
+                fan.Add((uint32_t) v);
+            }
+            assert(c.index - start == 3 * max(corners - 2, 0));
+        }
+    };
+    LoadLines(pool, blocks, mesh, count, parse);
+    return !errors.Any();
+}
+
+//=========================== PLY ==============================
+
+struct PlyProperty
+{
+    string name;
+    int size;               // bytes of the value, of every item for lists
+    int countSize = 0;      // lists only, bytes of the item count
+    bool real = false;      // float or double
+    bool isSigned = false;
+};
+
+struct PlyElement
+{
+    string name;
+    int64_t count;
+    vector<PlyProperty> properties;
+    bool HasLists() const
+    {
+        for (auto& p: properties) if (p.countSize) return true;
+        return false;
+    }
+    int Stride() const
+    {
+        int stride = 0;
+        for (auto& p: properties) stride += p.size;
+        return stride;
+    }
+    int Find(const string& name) const
+    {
+        for (int i = 0; i < (int) properties.size(); ++i) if (properties[i].name == name) return i;
+        return -1;
+    }
+};
+
+bool PlyType(const string& type, PlyProperty& p)
+{
+    static const struct { const char* name; int size; bool real, isSigned; } types[] = {
+        {"char", 1, false, true}, {"int8", 1, false, true}, {"uchar", 1, false, false}, {"uint8", 1, false, false},
+        {"short", 2, false, true}, {"int16", 2, false, true}, {"ushort", 2, false, false}, {"uint16", 2, false, false},
+        {"int", 4, false, true}, {"int32", 4, false, true}, {"uint", 4, false, false}, {"uint32", 4, false, false},
+        {"float", 4, true, true}, {"float32", 4, true, true}, {"double", 8, true, true}, {"float64", 8, true, true}
+    };
+    for (auto& t: types)
+    {
+        if (type == t.name)
+        {
+            p.size = t.size;
+            p.real = t.real;
+            p.isSigned = t.isSigned;
+            return true;
+        }
+    }
+    return false;
+}
+
+// a little endian binary value as a double, or an integer
+double ReadReal(const char* p, const PlyProperty& type)
+{
+    if (type.real && type.size == 4)
+    {
+        float f;
+        memcpy(&f, p, 4);
+        return f;
+    }
+    if (type.real)
+    {
+        double d;
+        memcpy(&d, p, 8);
+        return d;
+    }
+    int64_t v = 0;
+    memcpy(&v, p, type.size);
+    if (type.isSigned && type.size < 8)
+    {
+        int shift = 64 - 8 * type.size;
+        v = (v << shift) >> shift;
+    }
+    return (double) v;
+}
+
+int64_t ReadInt(const char* p, int size, bool isSigned)
+{
+    uint64_t v = 0;
+    memcpy(&v, p, size);
+    if (isSigned && size < 8)
+    {
+        int shift = 64 - 8 * size;
+        return ((int64_t) (v << shift)) >> shift;
+    }
+    return (int64_t) v;
+}
+
+bool LoadPly(const MappedFile& file, ThreadPool& pool, TriangleMesh& mesh, Errors& errors, bool& text)
+{
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    string format;
+    vector<PlyElement> elements;
+    bool first = true;
+    // the header, line by line up to end_header
+    while (true)
+    {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        if (!eol)
+        {
+            errors.Report(p - file.data, "no end_header");
+            return false;
+        }
+        string line(p, eol);
+        size_t offset = p - file.data;
+        p = eol + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        istringstream in(line);
+        string word;
+        in >> word;
+        if (first)
+        {
+            if (word != "ply")
+            {
+                errors.Report(offset, "not a ply file");
+                return false;
+            }
+            first = false;
+            continue;
+        }
+        if (word == "end_header") break;
+        if (word == "format")
+        {
+            in >> format;
+        }
+        else if (word == "element")
+        {
+            PlyElement e;
+            if (!(in >> e.name >> e.count) || e.count < 0)
+            {
+                errors.Report(offset, "bad element");
+                return false;
+            }
+            elements.push_back(e);
+        }
+        else if (word == "property")
+        {
+            PlyProperty prop;
+            string type;
+            in >> type;
+            bool ok = !elements.empty();
+            if (type == "list")
+            {
+                string countType, itemType;
+                in >> countType >> itemType;
+                PlyProperty count;
+                ok = ok && PlyType(countType, count) && !count.real && PlyType(itemType, prop) && !prop.real;
+                prop.countSize = count.size;
+            }
+            else
+            {
+                ok = ok && PlyType(type, prop);
+            }
+            if (!ok || !(in >> prop.name))
+            {
+                errors.Report(offset, "bad property");
+                return false;
+            }
+            elements.back().properties.push_back(prop);
+        }
+        else if (word != "comment" && word != "obj_info")
+        {
+            errors.Report(offset, "unknown header line");
+            return false;
+        }
+    }
+    size_t body = p - file.data;
+    text = format == "ascii";
+    if (format != "ascii" && format != "binary_little_endian")
+    {
+        errors.Report(0, "unsupported format " + format);
+        return false;
+    }
+
+    // the positions of the vertices and the list of vertex indices of the faces
+    int vertexElement = -1, faceElement = -1, faceList = -1;
+    int xyz[3];
+    for (int i = 0; i < (int) elements.size(); ++i)
+    {
+        if (elements[i].name == "vertex") vertexElement = i;
+        if (elements[i].name == "face") faceElement = i;
+    }
+    if (vertexElement >= 0)
+    {
+        const PlyElement& v = elements[vertexElement];
+        xyz[0] = v.Find("x");
+        xyz[1] = v.Find("y");
+        xyz[2] = v.Find("z");
+        if (xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0 || v.HasLists())
+        {
+            errors.Report(0, "vertices need x, y, z and no lists");
+            return false;
+        }
+    }
+    if (faceElement >= 0)
+    {
+        const PlyElement& f = elements[faceElement];
+        faceList = f.Find("vertex_indices");
+        if (faceList < 0) faceList = f.Find("vertex_index");
+        if (faceList < 0 || !f.properties[faceList].countSize)
+        {
+            errors.Report(0, "faces need a vertex_indices list");
+            return false;
+        }
+    }
+    if (vertexElement < 0 || faceElement < 0)
+    {
+        errors.Report(0, "no vertex or face element");
+        return false;
+    }
+    int64_t vertexCount = elements[vertexElement].count;
+    if (vertexCount > UINT32_MAX)
+    {
+        errors.Report(0, "too many vertices");
+        return false;
+    }
+
+    if (text)
+    {
+        // every element record is a line, the line number tells which element it belongs to
+        int64_t vertexLine = 0, faceLine = 0, records = 0;
+        for (int i = 0; i < (int) elements.size(); ++i)
+        {
+            if (i == vertexElement) vertexLine = records;
+            if (i == faceElement) faceLine = records;
+            records += elements[i].count;
+        }
+        const PlyElement& faces = elements[faceElement];
+        vector<Block> blocks = SplitLines(p, end);
+        pool.ParallelFor((int) blocks.size(), [&](int i, int) {
+            blocks[i].firstLine = count(blocks[i].begin, blocks[i].end, '\n');
+        });
+        int64_t lines = end[-1] == '\n' ? 0 : 1;
+        for (Block& b: blocks)
+        {
+            swap(lines, b.firstLine);
+            lines += b.firstLine;
+        }
+        // scalar properties in front of the index list are skipped
+        auto skipToList = [&](const char*& q, const char* eol) {
+            for (int k = 0; k < faceList; ++k)
+            {
+                SkipBlanks(q, eol);
+                SkipToken(q, eol);
+            }
+        };
+        auto countLine = [&](const char* q, const char* eol, int64_t line, Block& b) {
+            if (line >= vertexLine && line < vertexLine + vertexCount)
+            {
+                ++b.vertices;
+            }
+            else if (line >= faceLine && line < faceLine + faces.count)
+            {
+                int64_t n;
+                skipToList(q, eol);
+                if (ParseInt(q, eol, n)) b.triangles += max<int64_t>(n - 2, 0);
+            }
+        };
+        auto parseLine = [&](const char* q, const char* eol, int64_t line, Cursor& c) {
+            const char* start = q;
+            if (line >= vertexLine && line < vertexLine + vertexCount)
+            {
+                const PlyElement& v = elements[vertexElement];
+                float value;
+                for (int k = 0; k < (int) v.properties.size(); ++k)
+                {
+                    if (!ParseFloat(q, eol, value))
+                    {
+                        errors.Report(start - file.data, "bad vertex");
+                        break;
+                    }
+                    for (int axis = 0; axis < 3; ++axis) if (k == xyz[axis]) c.position[axis] = value;
+                }
+                c.position += 3;
+            }
+            else if (line >= faceLine && line < faceLine + faces.count)
+            {
+                int64_t n, v;
+                skipToList(q, eol);
+                if (!ParseInt(q, eol, n))
+                {
+                    n = 0;
+                    errors.Report(start - file.data, "bad face");
+                }
+                Fan fan(c);
+                for (int64_t k = 0; k < n; ++k)
+                {
+                    if (!ParseInt(q, eol, v) || v < 0 || v >= c.vertexCount)
+                    {
+                        errors.Report(start - file.data, "bad face index");
+                        v = 0;
+                    }
+                    if (n >= 3) fan.Add((uint32_t) v);
+                }
+            }
+        };
+        LoadLines(pool, blocks, mesh, countLine, parseLine);
+        if (lines < records) errors.Report(file.size, "file ends early");
+        return !errors.Any();
+    }
+
+    // binary: walk to the vertices and faces, fixed size records are skipped in one step
+    size_t pos = body;
+    size_t vertexBegin = 0;
+    // offset and first triangle of every BLOCK_FACES faces, and at the end
+    vector<size_t> faceOffsets;
+    vector<int64_t> faceTriangles;
+    for (int i = 0; i < (int) elements.size(); ++i)
+    {
+        const PlyElement& e = elements[i];
+        if (!e.HasLists())
+        {
+            if ((file.size - pos) / max(e.Stride(), 1) < (size_t) e.count)
+            {
+                errors.Report(file.size, "file ends early");
+                return false;
+            }
+            if (i == vertexElement) vertexBegin = pos;
+            pos += (size_t) e.count * e.Stride();
+            continue;
+        }
+        int64_t triangles = 0;
+        for (int64_t k = 0; k < e.count; ++k)
+        {
+            if (i == faceElement && k % BLOCK_FACES == 0)
+            {
+                faceOffsets.push_back(pos);
+                faceTriangles.push_back(triangles);
+            }
+            for (int j = 0; j < (int) e.properties.size(); ++j)
+            {
+                const PlyProperty& prop = e.properties[j];
+                if (file.size - pos < (size_t) prop.countSize + (prop.countSize ? 0 : prop.size))
+                {
+                    errors.Report(file.size, "file ends early");
+                    return false;
+                }
+                if (!prop.countSize)
+                {
+                    pos += prop.size;
+                    continue;
+                }
+                int64_t n = ReadInt(file.data + pos, prop.countSize, false);
+                pos += prop.countSize;
+                if ((file.size - pos) / prop.size < (size_t) n)
+                {
+                    errors.Report(file.size, "file ends early");
+                    return false;
+                }
+                pos += n * prop.size;
+                if (j == faceList) triangles += max<int64_t>(n - 2, 0);
+            }
+        }
+        if (i == faceElement)
+        {
+            faceOffsets.push_back(pos);
+            faceTriangles.push_back(triangles);
+        }
+    }
+
+    const PlyElement& vertices = elements[vertexElement];
+    const PlyElement& faces = elements[faceElement];
+    int stride = vertices.Stride();
+    int axisOffset[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        axisOffset[axis] = 0;
+        for (int k = 0; k < xyz[axis]; ++k) axisOffset[axis] += vertices.properties[k].size;
+    }
+    mesh.positions.resize(3 * vertexCount);
+    mesh.indices.resize(3 * faceTriangles.back());
+    int vertexBlocks = (int) ((vertexCount + BLOCK_FACES - 1) / BLOCK_FACES);
+    pool.ParallelFor(vertexBlocks, [&](int b, int) {
+        int64_t last = min(vertexCount, (b + 1) * BLOCK_FACES);
+        for (int64_t k = b * BLOCK_FACES; k < last; ++k)
+        {
+            const char* record = file.data + vertexBegin + k * stride;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                mesh.positions[3 * k + axis] = (float) ReadReal(record + axisOffset[axis], vertices.properties[xyz[axis]]);
+            }
+        }
+    });
+    pool.ParallelFor((int) faceOffsets.size() - 1, [&](int b, int) {
+        Cursor c = {nullptr, mesh.indices.data() + 3 * faceTriangles[b], 0, vertexCount};
+        const char* q = file.data + faceOffsets[b];
+        int64_t last = min(faces.count, (b + 1) * BLOCK_FACES);
+        for (int64_t k = b * BLOCK_FACES; k < last; ++k)
+        {
+            for (int j = 0; j < (int) faces.properties.size(); ++j)
+            {
+                const PlyProperty& prop = faces.properties[j];
+                if (!prop.countSize)
+                {
+                    q += prop.size;
+                    continue;
+                }
+                int64_t n = ReadInt(q, prop.countSize, false);
+                q += prop.countSize;
+                if (j == faceList && n >= 3)
+                {
+                    Fan fan(c);
+                    for (int64_t m = 0; m < n; ++m)
+                    {
+                        int64_t v = ReadInt(q + m * prop.size, prop.size, prop.isSigned);
+                        if (v < 0 || v >= vertexCount)
+                        {
+                            errors.Report(q - file.data, "bad face index");
+                            v = 0;
+                        }
+                        fan.Add((uint32_t) v);
+                    }
+                }
+                q += n * prop.size;
+            }
+        }
+    });
+    return !errors.Any();
+}
+}
+
+bool LoadMesh(const char* path, TriangleMesh& mesh, std::string& error, int threads)
+{
+    mesh.positions.clear();
+    mesh.indices.clear();
+    string name = path;
+    string extension = name.substr(min(name.size(), name.rfind('.') + 1));
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != "obj" && extension != "ply")
+    {
+        error = name + ": not an .obj or .ply file";
+        return false;
+    }
+    MappedFile file;
+    if (!file.Open(path, error)) return false;
+    ThreadPool pool(threads);
+    Errors errors;
+    bool text = true;
+    bool ok = extension == "obj" ? LoadObj(file, pool, mesh, errors) : LoadPly(file, pool, mesh, errors, text);
+    if (!ok)
+    {
+        error = errors.Describe(path, file.data, text);
+        mesh.positions.clear();
+        mesh.indices.clear();
+    }
+    return ok;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "stdafx.h"
+#include "object.h"
+
+/*
+ * Load the triangles of an OBJ or PLY file (ascii or binary little endian),
+ * told apart by the extension. Polygons are split into fans of triangles,
+ * everything but the vertex positions and faces is skipped.
+ *
+ * The file is memory mapped and parsed in place by `threads` threads
+ * (<= 0 for one per hardware thread): a first pass counts the vertices and
+ * triangles of every block of the file, then each block is parsed straight
+ * into its slice of the mesh buffers. Nothing is allocated per face.
+ * False with error set on failure.
+ */
+bool LoadMesh(const char* path, TriangleMesh& mesh, std::string& error, int threads = 0);
@@ -4,6 +4,8 @@
 
 #include "object.h"
 
+using namespace std;
+
 bool Sphere::IsHit(const Ray &r, double minT, double maxT, HitRecord &hitRec)
 {
     Vector3 oc = r.Origin() - center;
@@ -13,21 +15,133 @@ bool Sphere::IsHit(const Ray &r, double minT, double maxT, HitRecord &hitRec)
     double delta = b * b - a * c;
     if (delta > 0)
     {
-        double root = (-b - sqrt(delta)) / a;
+        double sq = sqrt(delta);
+        double root = (-b - sq) / a;
         if (minT + SURFACE_THICKNESS < root && root < maxT) {
-            hitRec.t = root;
-            hitRec.p = r.P(root);
-            hitRec.normal = (hitRec.p - center).UnitVector();
+            FillHit(r, root, hitRec);
             return true;
         }
-        root = (-b + sqrt(delta)) / a;
+        root = (-b + sq) / a;
         if (minT + SURFACE_THICKNESS < root && root < maxT)
         {
-            hitRec.t = root;
-            hitRec.p = r.P(root);
-            hitRec.normal = (hitRec.p - center).UnitVector();
+            FillHit(r, root, hitRec);
             return true;
         }
     }
     return false;
 }
+
+bool Sphere::Occluded(const Ray& r, double minT, double maxT)
+{
+    Vector3 oc = r.Origin() - center;
+    double a = r.Direction().Dot(r.Direction());
+    double b = oc.Dot(r.Direction());
+    double c = oc.Dot(oc) - radius * radius;
+    double delta = b * b - a * c;
+    if (!(delta > 0)) return false;
+    double sq = sqrt(delta);
+    double t1 = (-b - sq) / a, t2 = (-b + sq) / a;
+    return (minT + SURFACE_THICKNESS < t1 && t1 < maxT) || (minT + SURFACE_THICKNESS < t2 && t2 < maxT);
+}
+
+bool Sphere::SampleSolidAngle(const Vector3& from, double u1, double u2, Vector3& dir, double& pdf) const
+{
+    Vector3 toCenter = center - from;
+    double distanceSq = toCenter.Dot(toCenter);
+    if (distanceSq <= radius * radius) return false;
+    double cosMax = sqrt(1 - radius * radius / distanceSq);
+    double cosTheta = 1 - u1 * (1 - cosMax);
+    double sinTheta = sqrt(max(0.0, 1 - cosTheta * cosTheta));
+    double phi = 2 * M_PI * u2;
+
+    // frame around the axis toward the center
+    Vector3 w = toCenter / sqrt(distanceSq);
+    Vector3 a = fabs(w.e[0]) > 0.9 ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+    Vector3 v = w.Cross(a).UnitVector();
+    Vector3 u = v.Cross(w);
+    dir = u * (cos(phi) * sinTheta) + v * (sin(phi) * sinTheta) + w * cosTheta;
+    pdf = 1 / (2 * M_PI * (1 - cosMax));
+    return true;
+}
+
+double Sphere::SolidAnglePdf(const Vector3& from) const
+{
+    Vector3 toCenter = center - from;
+    double distanceSq = toCenter.Dot(toCenter);
+    if (distanceSq <= radius * radius) return 0;
+    double cosMax = sqrt(1 - radius * radius / distanceSq);
+    return 1 / (2 * M_PI * (1 - cosMax));
+}
+
+void Sphere::FillHit(const Ray& r, double t, HitRecord& hitRec) const
+{
+    hitRec.t = t;
+    hitRec.p = r.P(t);
+    hitRec.normal = (hitRec.p - center).UnitVector();
+    hitRec.backFace = false;
+}
+
+AABB Sphere::BoundingBox() const
+{
+    Vector3 extent{radius, radius, radius};
+    return {center - extent, center + extent};
+}
+
+bool Triangle::Intersect(const Ray& r, double minT, double maxT, double& t) const
+{
+    const uint32_t* v = &mesh->indices[3 * face];
+    Vector3 origin = r.Origin(), dir = r.Direction();
+
+    // shear the triangle into a space where the ray runs along +z from the origin
+    int kz = fabs(dir.e[0]) > fabs(dir.e[1]) ? (fabs(dir.e[0]) > fabs(dir.e[2]) ? 0 : 2)
+                                              : (fabs(dir.e[1]) > fabs(dir.e[2]) ? 1 : 2);
+    int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+    if (dir.e[kz] < 0) swap(kx, ky);
+    double sx = dir.e[kx] / dir.e[kz], sy = dir.e[ky] / dir.e[kz], sz = 1 / dir.e[kz];
+    Vector3 a = mesh->Vertex(v[0]) - origin;
+    Vector3 b = mesh->Vertex(v[1]) - origin;
+    Vector3 c = mesh->Vertex(v[2]) - origin;
+    double ax = a.e[kx] - sx * a.e[kz], ay = a.e[ky] - sy * a.e[kz];
+    double bx = b.e[kx] - sx * b.e[kz], by = b.e[ky] - sy * b.e[kz];
+    double cx = c.e[kx] - sx * c.e[kz], cy = c.e[ky] - sy * c.e[kz];
+
+    // the edge functions at the ray decide the hit, with ties counted on both sides
+    double e0 = cx * by - cy * bx;
+    double e1 = ax * cy - ay * cx;
+    double e2 = bx * ay - by * ax;
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) return false;
+    double det = e0 + e1 + e2;
+    if (det == 0) return false;
+    double tScaled = (e0 * a.e[kz] + e1 * b.e[kz] + e2 * c.e[kz]) * sz;
+    t = tScaled / det;
+    return minT + SURFACE_THICKNESS < t && t < maxT;
+}
+
+bool Triangle::IsHit(const Ray& r, double minT, double maxT, HitRecord& hitRec)
+{
+    double t;
+    if (!Intersect(r, minT, maxT, t)) return false;
+    const uint32_t* v = &mesh->indices[3 * face];
+    Vector3 p0 = mesh->Vertex(v[0]);
+    hitRec.t = t;
+    hitRec.p = r.P(t);
+    Vector3 normal = (mesh->Vertex(v[1]) - p0).Cross(mesh->Vertex(v[2]) - p0).UnitVector();
+    // meshes may be open or inconsistently wound, so shade the side the ray sees
+    hitRec.backFace = r.Direction().Dot(normal) > 0;
+    hitRec.normal = hitRec.backFace ? -normal : normal;
+    return true;
+}
+
+bool Triangle::Occluded(const Ray& r, double minT, double maxT)
+{
+    double t;
+    return Intersect(r, minT, maxT, t);
+}
+
+AABB Triangle::BoundingBox() const
+{
+    const uint32_t* v = &mesh->indices[3 * face];
+    AABB box;
+    for (int i = 0; i < 3; ++i) box.Extend(mesh->Vertex(v[i]));
+    return box;
+}
@@ -7,14 +7,60 @@
 #include "stdafx.h"
 #include "common.h"
 
-class Sphere : public Object
+class Sphere final : public Object
 {
 public:
     Sphere(Vector3 center, double radius, const Material& m) : center(center), radius(radius), Object(m) { }
     bool IsHit(const Ray& r, double minT, double maxT, HitRecord& hitRec) override;
+    bool Occluded(const Ray& r, double minT, double maxT) override;
+    AABB BoundingBox() const override;
+    /*
+     * Sample a direction from `from` uniformly in the cone the sphere subtends,
+     * for light sampling. pdf is per solid angle. False if from is inside.
+     */
+    bool SampleSolidAngle(const Vector3& from, double u1, double u2, Vector3& dir, double& pdf) const;
+    // pdf of SampleSolidAngle for any direction that hits the sphere
+    double SolidAnglePdf(const Vector3& from) const;
+    // hit point and normal for a ray known to hit at t
+    void FillHit(const Ray& r, double t, HitRecord& hitRec) const;
     Vector3 Center() { return center; }
+    void SetCenter(const Vector3& center) { this->center = center; }
     double Radius() { return radius; }
 protected:
     Vector3 center;
     double radius;
-};
\ No newline at end of file
+};
+/*
+ * Vertex and index buffers shared by the triangles of a mesh. Triangle i
+ * has the vertices indices[3i], indices[3i + 1] and indices[3i + 2].
+ * Positions are stored as floats to halve the memory of large meshes.
+ */
+struct TriangleMesh
+{
+    std::vector<float> positions;   // x, y, z of every vertex
+    std::vector<uint32_t> indices;
+    int Triangles() const { return (int) (indices.size() / 3); }
+    int Vertices() const { return (int) (positions.size() / 3); }
+    Vector3 Vertex(uint32_t i) const { return {positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]}; }
+    size_t Bytes() const { return positions.capacity() * sizeof(float) + indices.capacity() * sizeof(uint32_t); }
+};
+
+/*
+ * One triangle of a mesh, intersected watertight (Woop, Benthin and Wald
+ * 2013): rays through a shared edge or vertex hit exactly one of the
+ * triangles around it. The normal follows the winding, counterclockwise
+ * seen from the front.
+ */
+class Triangle final : public Object
+{
+public:
+    Triangle(const TriangleMesh& mesh, int face, const Material& m) : Object(m), mesh(&mesh), face(face) { }
+    bool IsHit(const Ray& r, double minT, double maxT, HitRecord& hitRec) override;
+    bool Occluded(const Ray& r, double minT, double maxT) override;
+    AABB BoundingBox() const override;
+protected:
+    // t of the hit in (minT, maxT), false on a miss
+    bool Intersect(const Ray& r, double minT, double maxT, double& t) const;
+    const TriangleMesh* mesh;
+    int face;
+};
@@ -1,16 +1,82 @@
 #include "ppm.h"
 
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 using namespace std;
-int WriteRGBImg(const char* path, int nx, int ny, Color *pix)
+
+std::string PPMHeader(int nx, int ny)
 {
-    std::ofstream fout(path);
-    fout << "P3\n" << nx << " " << ny << "\n255\n";
-    for (int i = 0; i < nx * ny; ++i)
+    return "P6\n" + to_string(nx) + " " + to_string(ny) + "\n255\n";
+}
+
+int WriteP6(const char* path, int nx, int ny, const unsigned char* rgb)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    string header = PPMHeader(nx, ny);
+    iovec iov[2];
+    iov[0].iov_base = (void*) header.data();
+    iov[0].iov_len = header.size();
+    iov[1].iov_base = (void*) rgb;
+    iov[1].iov_len = (size_t) nx * ny * 3;
+    int first = 0;
+    // writev may write less than asked for, continue where it stopped
+    while (first < 2)
     {
-        fout << (int) pix[i][0] << "\t" << (int) pix[i][1] << "\t" << (int) pix[i][2] << "\n";
+        ssize_t n = writev(fd, iov + first, 2 - first);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        while (first < 2 && (size_t) n >= iov[first].iov_len)
+        {
+            n -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < 2)
+        {
+            iov[first].iov_base = (char*) iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
     }
-    fout.flush();
-    return 0;
+    return close(fd);
 }
 
+int WriteSampleMap(const char* path, const FrameBuffer& buffer)
+{
+    int nx = buffer.Width(), ny = buffer.Height();
+    float maxSamples = 1;
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            maxSamples = max(maxSamples, buffer.At(i, j).n);
+        }
+    }
+    vector<unsigned char> rgb((size_t) nx * ny * 3);
+    for (int j = 0; j < ny; ++j)
+    {
+        for (int i = 0; i < nx; ++i)
+        {
+            unsigned char v = (unsigned char) (255.99f * buffer.At(i, j).n / maxSamples);
+            unsigned char* p = &rgb[3 * ((size_t) j * nx + i)];
+            p[0] = p[1] = p[2] = v;
+        }
+    }
+    return WriteP6(path, nx, ny, rgb.data());
+}
 
+int WriteRGBImg(const char* path, int nx, int ny, Color *pix)
+{
+    vector<unsigned char> rgb((size_t) nx * ny * 3);
+    for (int i = 0; i < nx * ny; ++i)
+    {
+        QuantizePixel(pix[i], &rgb[3 * i]);
+    }
+    return WriteP6(path, nx, ny, rgb.data());
+}
@@ -2,9 +2,28 @@
 
 #include "stdafx.h"
 #include "common.h"
+#include "framebuffer.h"
+
+/* Header of a binary (P6) ppm file */
+std::string PPMHeader(int nx, int ny);
+
+/* Convert a color in [0, 255.99] to 8-bit rgb, out of range values are clamped */
+inline void QuantizePixel(const Color& c, unsigned char* rgb)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        double v = c.e[i];
+        rgb[i] = (unsigned char) (v <= 0 ? 0 : v >= 255 ? 255 : (int) v);
+    }
+}
+
+/* Write a whole P6 file with one writev call, returns 0 on success */
+int WriteP6(const char* path, int nx, int ny, const unsigned char* rgb);
+
+/* Grayscale image of the samples taken per pixel, white is the maximum */
+int WriteSampleMap(const char* path, const FrameBuffer& buffer);
 
 /**
  * Output an image in ppm format 
  */
 int WriteRGBImg(const char* path, int nx, int ny, Color *pix);
-
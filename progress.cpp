@@ -0,0 +1,93 @@
+#include "progress.h"
+
+using namespace std;
+
+ProgressTracker::ProgressTracker(ProgressMode mode, double interval)
+        : mode(mode), interval(interval)
+{
+}
+
+void ProgressTracker::Start(int64_t totalSamples)
+{
+    Stop();
+    total = totalSamples;
+    samples = 0;
+    start = chrono::steady_clock::now();
+    paused = false;
+    if (mode == ProgressMode::Off) return;
+    StartReporter();
+}
+
+void ProgressTracker::Stop()
+{
+    if (StopReporter() || paused) Report(true);
+    paused = false;
+}
+
+void ProgressTracker::Pause()
+{
+    paused = StopReporter() || paused;
+}
+
+void ProgressTracker::Resume()
+{
+    if (!paused) return;
+    paused = false;
+    StartReporter();
+}
+
+void ProgressTracker::StartReporter()
+{
+    stopping = false;
+    reporter = thread([this] {
+        unique_lock<mutex> lk(stopMutex);
+        while (!stopSignal.wait_for(lk, chrono::duration<double>(interval), [this] { return stopping; }))
+        {
+            Report(false);
+        }
+    });
+}
+
+bool ProgressTracker::StopReporter()
+{
+    if (!reporter.joinable()) return false;
+    {
+        lock_guard<mutex> lk(stopMutex);
+        stopping = true;
+    }
+    stopSignal.notify_all();
+    reporter.join();
+    return true;
+}
+
+void ProgressTracker::Report(bool final)
+{
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double progress = Progress();
+    double samplesPerSecond = elapsed > 0 ? samples.load() / elapsed : 0;
+    double eta = progress > 0 ? elapsed / progress - elapsed : -1;
+
+    if (mode == ProgressMode::Human)
+    {
+        printf("\33[2K\r%.2f%%  %.3g samples/s", progress * 100, samplesPerSecond);
+        if (eta >= 0 && !final)
+        {
+            printf("  ETA %dm%02ds", (int) eta / 60, (int) eta % 60);
+        }
+        if (final)
+        {
+            printf("  done in %.1fs\n", elapsed);
+        }
+    }
+    else if (mode == ProgressMode::Machine)
+    {
+        // an unknown eta is null rather than a time
+        char etaText[32] = "null";
+        if (eta >= 0) snprintf(etaText, sizeof(etaText), "%.3f", eta);
+        printf("{\"progress\": %.4f, \"samples\": %lld, "
+               "\"elapsed\": %.3f, \"eta\": %s, \"samples_per_sec\": %.1f, \"done\": %s}\n",
+               progress, (long long) samples.load(),
+               elapsed, etaText, samplesPerSecond, final ? "true" : "false");
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+enum class ProgressMode
+{
+    Off,        // batch runs, print nothing
+    Human,      // one status line, rewritten in place
+    Machine     // one JSON object per line
+};
+
+/**
+ * Progress of a render. Render threads add finished work in batches,
+ * which only costs an atomic add; a reporter thread prints the state
+ * at a fixed rate so the render threads never wait on stdout.
+ */
+class ProgressTracker
+{
+public:
+    /* interval: seconds between two reports */
+    ProgressTracker(ProgressMode mode, double interval);
+    ~ProgressTracker() { Stop(); }
+
+    /* Reset the counters and start reporting, totalSamples is the expected amount of work */
+    void Start(int64_t totalSamples);
+
+    /* Called by render threads, preferably once per batch of pixels */
+    void Add(int64_t samples)
+    {
+        this->samples.fetch_add(samples, std::memory_order_relaxed);
+    }
+
+    /* Stop reporting, prints a final report */
+    void Stop();
+
+    /* Stop the reporter thread for a while, keeping the counters, e.g. around a fork */
+    void Pause();
+    void Resume();
+    double Progress() const { return total ? std::min(1.0, (double) samples.load() / total) : 1; }
+private:
+    void Report(bool final);
+    void StartReporter();
+    // true if it was running
+    bool StopReporter();
+
+    ProgressMode mode;
+    double interval;
+    int64_t total = 0;
+    std::atomic<int64_t> samples{0};
+    std::chrono::steady_clock::time_point start;
+
+    std::thread reporter;
+    std::mutex stopMutex;
+    std::condition_variable stopSignal;
+    bool stopping = false;
+    bool paused = false;
+};
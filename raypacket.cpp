@@ -0,0 +1,61 @@
+#include "raypacket.h"
+
+using namespace std;
+
+void RayPacket::Prepare(double maxT)
+{
+    coherent = size > 0;
+    for (int i = 0; i < size; ++i)
+    {
+        Vector3 origin = rays[i].Origin(), dir = rays[i].Direction();
+        invDir[i] = {1 / dir.e[0], 1 / dir.e[1], 1 / dir.e[2]};
+        tMax[i] = maxT;
+        object[i] = -1;
+        for (int k = 0; k < 3; ++k)
+        {
+            if (i == 0)
+            {
+                originMin.e[k] = originMax.e[k] = origin.e[k];
+                invDirMin.e[k] = invDirMax.e[k] = invDir[i].e[k];
+                continue;
+            }
+            originMin.e[k] = min(originMin.e[k], origin.e[k]);
+            originMax.e[k] = max(originMax.e[k], origin.e[k]);
+            invDirMin.e[k] = min(invDirMin.e[k], invDir[i].e[k]);
+            invDirMax.e[k] = max(invDirMax.e[k], invDir[i].e[k]);
+        }
+    }
+    for (int k = 0; coherent && k < 3; ++k)
+    {
+        coherent = isfinite(invDirMin.e[k]) && isfinite(invDirMax.e[k]) &&
+                   (invDirMin.e[k] > 0) == (invDirMax.e[k] > 0);
+    }
+}
+
+// bounds of {a * b} for a in [aMin, aMax], b in [bMin, bMax]
+static void IntervalProduct(double aMin, double aMax, double bMin, double bMax, double& lo, double& hi)
+{
+    double p0 = aMin * bMin, p1 = aMin * bMax, p2 = aMax * bMin, p3 = aMax * bMax;
+    lo = min(min(p0, p1), min(p2, p3));
+    hi = max(max(p0, p1), max(p2, p3));
+}
+
+bool RayPacket::Misses(const AABB& box, double minT, double maxT) const
+{
+    // lower bound of every ray's entry and upper bound of every ray's exit
+    double entry = minT, exit = maxT;
+    for (int k = 0; k < 3; ++k)
+    {
+        bool positive = invDirMin.e[k] > 0;
+        double nearPlane = positive ? box.pMin.e[k] : box.pMax.e[k];
+        double farPlane = positive ? box.pMax.e[k] : box.pMin.e[k];
+        double lo, hi;
+        IntervalProduct(nearPlane - originMax.e[k], nearPlane - originMin.e[k],
+                        invDirMin.e[k], invDirMax.e[k], lo, hi);
+        entry = max(entry, lo);
+        IntervalProduct(farPlane - originMax.e[k], farPlane - originMin.e[k],
+                        invDirMin.e[k], invDirMax.e[k], lo, hi);
+        exit = min(exit, hi);
+    }
+    return entry > exit;
+}
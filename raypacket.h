@@ -0,0 +1,36 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+
+/**
+ * A bundle of coherent rays (e.g. the primary rays of a block of pixels)
+ * traced through the BVH together, see Objects::IsHit(RayPacket&).
+ * Fill it with Add, then Prepare before tracing.
+ */
+struct RayPacket
+{
+    static const int MAX_SIZE = 64;
+
+    void Clear() { size = 0; }
+    void Add(const Ray& r) { rays[size++] = r; }
+
+    /* Reset the results and compute the bounds used to cull the whole packet */
+    void Prepare(double maxT);
+
+    /*
+     * Conservative test from the bounds of the origins and directions:
+     * true only if no ray of the packet can hit the box in (minT, maxT).
+     */
+    bool Misses(const AABB& box, double minT, double maxT) const;
+
+    int size = 0;
+    Ray rays[MAX_SIZE];
+    Vector3 invDir[MAX_SIZE];
+    // closest hit so far, object is -1 while the ray has hit nothing
+    double tMax[MAX_SIZE];
+    int object[MAX_SIZE];
+    // the bounds are only usable when the directions agree in sign on every axis
+    bool coherent = false;
+    Vector3 originMin, originMax, invDirMin, invDirMax;
+};
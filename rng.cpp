@@ -0,0 +1,33 @@
+#include "rng.h"
+
+uint64_t Mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void Rng::Seed(uint64_t seed, uint64_t stream)
+{
+    state = 0;
+    inc = (stream << 1u) | 1u;
+    NextUInt();
+    state += seed;
+    NextUInt();
+}
+
+void Rng::SetSample(const Sampler* sampler, uint64_t pixel, uint32_t index)
+{
+    this->sampler = sampler;
+    this->pixel = pixel;
+    this->index = index;
+    dimension = 0;
+}
+
+void SeedThreadRng(uint64_t pixel, uint64_t sample, uint64_t frame, const Sampler* sampler)
+{
+    Rng& rng = ThreadRng();
+    rng.Seed(Mix(pixel ^ Mix(sample ^ Mix(frame))), frame);
+    rng.SetSample(sampler, pixel, (uint32_t) sample);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "stdafx.h"
+#include "sampler.h"
+
+/**
+ * PCG32 random number generator, see pcg-random.org.
+ * The render loop reseeds the calling thread's generator from
+ * (pixel, sample, frame) before every sample, so the numbers a sample
+ * sees do not depend on which thread renders it or in what order.
+ * The generator also carries the sample's place in a Sampler, for the
+ * numbers that pick directions and positions (NextSample); choices like
+ * russian roulette keep using NextDouble.
+ */
+class Rng
+{
+public:
+    constexpr Rng() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL),
+                      sampler(nullptr), pixel(0), index(0), dimension(0) { }
+    Rng(uint64_t seed, uint64_t stream) : Rng() { Seed(seed, stream); }
+    void Seed(uint64_t seed, uint64_t stream);
+    inline uint32_t NextUInt();
+    // uniform in [0, 1)
+    inline double NextDouble() { return NextUInt() * (1.0 / 4294967296.0); }
+
+    /* Take the dimensions of sample `index` of a pixel from sampler, null for plain random numbers */
+    void SetSample(const Sampler* sampler, uint64_t pixel, uint32_t index);
+
+    // next dimension of the sample, uniform in [0, 1)
+    inline double NextSample();
+
+    // next pair of dimensions, starting at an even one which keeps pairs stratified together
+    inline void NextSample2D(double& u1, double& u2);
+private:
+    uint64_t state, inc;
+    const Sampler* sampler;
+    uint64_t pixel;
+    uint32_t index, dimension;
+};
+
+/* Generator of the calling thread */
+inline Rng& ThreadRng()
+{
+    static thread_local Rng rng;
+    return rng;
+}
+
+/* splitmix64 finalizer, spreads counters over the whole seed space */
+uint64_t Mix(uint64_t x);
+
+/* Start the stream of the calling thread for one sample of a pixel, taking its dimensions from sampler if set */
+void SeedThreadRng(uint64_t pixel, uint64_t sample, uint64_t frame, const Sampler* sampler = nullptr);
+
+/* Uniform in [0, 1) from the calling thread's generator, use instead of drand48() */
+inline double RandomDouble()
+{
+    return ThreadRng().NextDouble();
+}
+
+/* Next dimension of the calling thread's sample, for directions and positions */
+inline double SampleDouble()
+{
+    return ThreadRng().NextSample();
+}
+
+/* Next pair of dimensions of the calling thread's sample */
+inline void Sample2D(double& u1, double& u2)
+{
+    ThreadRng().NextSample2D(u1, u2);
+}
+
+uint32_t Rng::NextUInt()
+{
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + inc;
+    uint32_t xorShifted = (uint32_t) (((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = (uint32_t) (old >> 59u);
+    return (xorShifted >> rot) | (xorShifted << ((-rot) & 31));
+}
+
+double Rng::NextSample()
+{
+    if (!sampler) return NextDouble();
+    return sampler->Get(pixel, index, dimension++);
+}
+
+void Rng::NextSample2D(double& u1, double& u2)
+{
+    if (!sampler)
+    {
+        u1 = NextDouble();
+        u2 = NextDouble();
+        return;
+    }
+    dimension += dimension & 1;
+    u1 = sampler->Get(pixel, index, dimension);
+    u2 = sampler->Get(pixel, index, dimension + 1);
+    dimension += 2;
+}
@@ -0,0 +1,253 @@
+#include "sampler.h"
+#include "rng.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+inline double ToUnit(uint32_t x)
+{
+    return x * (1.0 / 4294967296.0);
+}
+
+inline uint32_t Hash(uint64_t a, uint64_t b, uint64_t c)
+{
+    return (uint32_t) Mix(a * 0x9e3779b97f4a7c15ULL + b * 0xc2b2ae3d27d4eb4fULL + c);
+}
+
+// Kensler's permutation of [0, l) picked by p, for any l
+uint32_t Permute(uint32_t i, uint32_t l, uint32_t p)
+{
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+uint32_t ReverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// Laine-Karras style hash on reversed bits: higher bits only depend on lower ones, an Owen scramble
+uint32_t OwenScramble(uint32_t x, uint32_t seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return ReverseBits(x);
+}
+
+// the first 4 Sobol dimensions, the generator matrices (Joe and Kuo) applied a byte of the index at a time
+struct SobolTables
+{
+    uint32_t bytes[4][4][256];
+    SobolTables()
+    {
+        // degree, coefficients and initial m of the primitive polynomials of dimensions 1 to 3
+        const int s[] = {1, 2, 3};
+        const uint32_t a[] = {0, 1, 1};
+        const uint32_t m[][3] = {{1}, {1, 3}, {1, 3, 1}};
+        uint32_t v[4][32];
+        for (int k = 0; k < 32; ++k)
+        {
+            v[0][k] = 1u << (31 - k);
+        }
+        for (int d = 1; d < 4; ++d)
+        {
+            int degree = s[d - 1];
+            for (int k = 0; k < 32; ++k)
+            {
+                if (k < degree)
+                {
+                    v[d][k] = m[d - 1][k] << (31 - k);
+                    continue;
+                }
+                v[d][k] = v[d][k - degree] ^ (v[d][k - degree] >> degree);
+                for (int l = 1; l < degree; ++l)
+                {
+                    if ((a[d - 1] >> (degree - 1 - l)) & 1)
+                    {
+                        v[d][k] ^= v[d][k - l];
+                    }
+                }
+            }
+        }
+        for (int d = 0; d < 4; ++d)
+        {
+            for (int byte = 0; byte < 4; ++byte)
+            {
+                for (int value = 0; value < 256; ++value)
+                {
+                    uint32_t x = 0;
+                    for (int bit = 0; bit < 8; ++bit)
+                    {
+                        if ((value >> bit) & 1) x ^= v[d][byte * 8 + bit];
+                    }
+                    bytes[d][byte][value] = x;
+                }
+            }
+        }
+    }
+};
+
+const SobolTables sobolTables;
+
+inline uint32_t Sobol(uint32_t index, int dimension)
+{
+    const uint32_t (*t)[256] = sobolTables.bytes[dimension];
+    return t[0][index & 0xff] ^ t[1][(index >> 8) & 0xff] ^ t[2][(index >> 16) & 0xff] ^ t[3][index >> 24];
+}
+
+// point `index` of Owen scrambled Sobol, the group seed shuffles the points, the dimension seed the values
+uint32_t ScrambledSobol(uint32_t index, uint32_t dimension, uint32_t groupSeed, uint32_t dimensionSeed)
+{
+    index = OwenScramble(index, groupSeed);
+    return OwenScramble(Sobol(index, dimension % 4), dimensionSeed);
+}
+
+/*
+ * Blue noise ranks of a MASK x MASK torus by void and cluster: points are
+ * added one at a time into the largest void, found as the lowest energy of
+ * a gaussian splat around every point placed so far. The order a pixel is
+ * filled in becomes its value.
+ */
+const int MASK = 64;
+
+struct BlueNoiseMask
+{
+    float value[MASK * MASK];
+    BlueNoiseMask()
+    {
+        const int radius = 6;
+        const double sigma2 = 2 * 1.5 * 1.5;
+        vector<double> energy(MASK * MASK);
+        vector<bool> filled(MASK * MASK, false);
+        // a tiny random energy breaks the ties of the empty mask
+        for (int p = 0; p < MASK * MASK; ++p)
+        {
+            energy[p] = ToUnit(Hash(p, 0x6d61736b, 0)) * 1e-6;
+        }
+        for (int rank = 0; rank < MASK * MASK; ++rank)
+        {
+            int best = -1;
+            for (int p = 0; p < MASK * MASK; ++p)
+            {
+                if (!filled[p] && (best < 0 || energy[p] < energy[best])) best = p;
+            }
+            filled[best] = true;
+            value[best] = (rank + 0.5f) / (MASK * MASK);
+            int bx = best % MASK, by = best / MASK;
+            for (int dy = -radius; dy <= radius; ++dy)
+            {
+                for (int dx = -radius; dx <= radius; ++dx)
+                {
+                    int p = ((by + dy + MASK) % MASK) * MASK + (bx + dx + MASK) % MASK;
+                    energy[p] += exp(-(dx * dx + dy * dy) / sigma2);
+                }
+            }
+        }
+    }
+};
+}
+
+double IndependentSampler::Get(uint64_t pixel, uint32_t index, uint32_t dimension) const
+{
+    return ToUnit(Hash(pixel, ((uint64_t) index << 32) | dimension, seed));
+}
+
+StratifiedSampler::StratifiedSampler(int samples, uint64_t seed) : seed(seed)
+{
+    samples = max(samples, 1);
+    m = (uint32_t) max(1.0, floor(sqrt((double) samples)));
+    n = (samples + m - 1) / m;
+}
+
+double StratifiedSampler::Get(uint64_t pixel, uint32_t index, uint32_t dimension) const
+{
+    uint32_t cells = m * n;
+    uint32_t p = Hash(pixel, ((uint64_t) (index / cells) << 32) | (dimension / 2), seed);
+    uint32_t s = Permute(index % cells, cells, p * 0x51633e2d);
+    if (dimension % 2 == 0)
+    {
+        uint32_t sy = Permute(s / m, n, p * 0x68bc21eb);
+        double jx = ToUnit(Hash(s, p, 0xa399d265));
+        return min((s % m + (sy + jx) / n) / m, 1 - 1e-9);
+    }
+    uint32_t sx = Permute(s % m, m, p * 0x02e5be93);
+    double jy = ToUnit(Hash(s, p, 0x711ad6a5));
+    return min((s / m + (sx + jy) / m) / n, 1 - 1e-9);
+}
+
+double SobolSampler::Get(uint64_t pixel, uint32_t index, uint32_t dimension) const
+{
+    uint32_t groupSeed = Hash(pixel, dimension / 4, seed);
+    uint32_t dimensionSeed = Hash(pixel, ((uint64_t) 1 << 32) | dimension, seed);
+    return ToUnit(ScrambledSobol(index, dimension, groupSeed, dimensionSeed));
+}
+
+double BlueNoiseSampler::Get(uint64_t pixel, uint32_t index, uint32_t dimension) const
+{
+    static const BlueNoiseMask mask;
+    uint32_t groupSeed = Hash(0, dimension / 4, seed);
+    uint32_t dimensionSeed = Hash(0, ((uint64_t) 1 << 32) | dimension, seed);
+    double x = ToUnit(ScrambledSobol(index, dimension, groupSeed, dimensionSeed));
+
+    // the same offset for a pair of dimensions would correlate them, so every dimension has its own
+    uint32_t offset = Hash(dimension, 0x626c7565, seed);
+    uint32_t p = (uint32_t) pixel, w = (uint32_t) width;
+    int px = (int) ((p % w + offset) % MASK);
+    int py = (int) ((p / w + (offset >> 16)) % MASK);
+    x += mask.value[py * MASK + px];
+    return x < 1 ? x : x - 1;
+}
+
+unique_ptr<Sampler> MakeSampler(SamplerType type, int nx, int samples, uint64_t seed)
+{
+    switch (type)
+    {
+    case SamplerType::Independent:
+        return unique_ptr<Sampler>(new IndependentSampler(seed));
+    case SamplerType::Stratified:
+        return unique_ptr<Sampler>(new StratifiedSampler(samples, seed));
+    case SamplerType::Sobol:
+        return unique_ptr<Sampler>(new SobolSampler(seed));
+    case SamplerType::BlueNoise:
+        return unique_ptr<Sampler>(new BlueNoiseSampler(nx, seed));
+    }
+    return nullptr;
+}
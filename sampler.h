@@ -0,0 +1,86 @@
+#pragma once
+
+#include "stdafx.h"
+
+enum class SamplerType
+{
+    Independent,    // uniform random numbers, no stratification
+    Stratified,     // correlated multi-jittered pairs of dimensions
+    Sobol,          // Owen scrambled Sobol, decorrelated per pixel
+    BlueNoise       // Owen scrambled Sobol shared by all pixels, shifted by a blue noise mask
+};
+
+/**
+ * Sample values by (pixel, sample index, dimension), so a sample's numbers
+ * do not depend on which thread takes it or in what order. Dimensions are
+ * handed out in pairs starting at even ones (see Rng::NextSample2D), the
+ * samplers stratify 2-d projections of such pairs.
+ */
+class Sampler
+{
+public:
+    virtual ~Sampler() = default;
+    /* Dimension `dimension` of sample `index` of a pixel, in [0, 1) */
+    virtual double Get(uint64_t pixel, uint32_t index, uint32_t dimension) const = 0;
+};
+
+class IndependentSampler : public Sampler
+{
+public:
+    explicit IndependentSampler(uint64_t seed) : seed(seed) { }
+    double Get(uint64_t pixel, uint32_t index, uint32_t dimension) const override;
+protected:
+    uint64_t seed;
+};
+
+/*
+ * Kensler's correlated multi-jittered sampling: every pair of dimensions is
+ * stratified both on an m x n grid and on its rows and columns, for the
+ * expected number of samples. Samples past that start a new pattern.
+ */
+class StratifiedSampler : public Sampler
+{
+public:
+    StratifiedSampler(int samples, uint64_t seed);
+    double Get(uint64_t pixel, uint32_t index, uint32_t dimension) const override;
+protected:
+    uint32_t m, n;
+    uint64_t seed;
+};
+
+/*
+ * 4-d Sobol padded to any dimension by Owen scrambling (Burley 2020):
+ * each group of 4 dimensions gets its own shuffle of the sample index and
+ * each dimension its own scramble of the values, both hashed from the pixel.
+ * Best with power of 2 sample counts.
+ */
+class SobolSampler : public Sampler
+{
+public:
+    explicit SobolSampler(uint64_t seed) : seed(seed) { }
+    double Get(uint64_t pixel, uint32_t index, uint32_t dimension) const override;
+protected:
+    uint64_t seed;
+};
+
+/*
+ * Every pixel takes the same scrambled Sobol points, toroidally shifted by
+ * a 64x64 blue noise mask (a different offset into it per dimension), so
+ * the error left at low sample counts is spread as high frequency noise
+ * between neighbouring pixels.
+ */
+class BlueNoiseSampler : public Sampler
+{
+public:
+    BlueNoiseSampler(int width, uint64_t seed) : width(width), seed(seed) { }
+    double Get(uint64_t pixel, uint32_t index, uint32_t dimension) const override;
+protected:
+    int width;
+    uint64_t seed;
+};
+
+/*
+ * Sampler for an image nx pixels wide taking about `samples` samples per
+ * pixel, the seed picks a different set of sequences (one per frame).
+ */
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, int nx, int samples, uint64_t seed);
@@ -0,0 +1,707 @@
+#include "scene.h"
+#include "material.h"
+#include "meshloader.h"
+#include "rng.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+namespace
+{
+const char CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', 0};
+const uint32_t CACHE_VERSION = 3;
+// arrays start at multiples of this in a cache, the mapping itself is page aligned
+const uint64_t CACHE_ALIGN = 64;
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t materialCount, sphereCount, motionCount, meshCount;
+    uint64_t materialOffset, sphereOffset, motionOffset, meshOffset;
+    RenderSettings settings;
+};
+
+uint64_t AlignUp(uint64_t x)
+{
+    return (x + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+}
+
+bool WriteAll(int fd, const void* data, size_t size)
+{
+    const char* p = (const char*) data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// 64-bit FNV-1a
+struct Hasher
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    void Add(const void* data, size_t size)
+    {
+        const unsigned char* p = (const unsigned char*) data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        }
+    }
+    template <class T>
+    void Add(const T& value) { Add(&value, sizeof(value)); }
+};
+
+// range checks of the settings, shared by text scenes and caches: what is wrong, empty if nothing
+string SettingsError(const RenderSettings& s)
+{
+    if (s.nx <= 0 || s.ny <= 0) return "image size must be positive";
+    if (s.samples <= 0) return "samples must be positive";
+    if (s.maxDepth <= 0) return "depth must be positive";
+    if (s.frames <= 0) return "frames must be positive";
+    if (s.sampler < (int32_t) SamplerType::Independent || s.sampler > (int32_t) SamplerType::BlueNoise)
+    {
+        return "unknown sampler";
+    }
+    return "";
+}
+
+bool ValidKind(int32_t kind)
+{
+    return kind == (int32_t) MaterialKind::Lambertian || kind == (int32_t) MaterialKind::Metal ||
+           kind == (int32_t) MaterialKind::Glass || kind == (int32_t) MaterialKind::Emissive;
+}
+
+// whitespace separated tokens of one line of a text scene, up to a #
+class LineTokens
+{
+public:
+    LineTokens(const char* begin, const char* end) : p(begin), end(end)
+    {
+        const char* comment = (const char*) memchr(begin, '#', end - begin);
+        if (comment) this->end = comment;
+    }
+
+    bool AtEnd()
+    {
+        SkipSpaces();
+        return p == end;
+    }
+
+    bool Word(string& word)
+    {
+        if (AtEnd()) return false;
+        const char* first = p;
+        while (p < end && !isspace((unsigned char) *p)) ++p;
+        word.assign(first, p);
+        return true;
+    }
+
+    bool Number(double& x)
+    {
+        if (AtEnd()) return false;
+        char* stop;
+        x = strtod(p, &stop);
+        if (stop == p || stop > end || (stop < end && !isspace((unsigned char) *stop))) return false;
+        p = stop;
+        return true;
+    }
+
+    bool Int(int32_t& x)
+    {
+        double d;
+        if (!Number(d) || d != (int32_t) d) return false;
+        x = (int32_t) d;
+        return true;
+    }
+
+    bool Numbers(double* x, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            if (!Number(x[i])) return false;
+        }
+        return true;
+    }
+private:
+    void SkipSpaces()
+    {
+        while (p < end && isspace((unsigned char) *p)) ++p;
+    }
+    const char* p;
+    const char* end;
+};
+}
+
+bool ParseSamplerType(const string& name, SamplerType& type)
+{
+    if (name == "independent") type = SamplerType::Independent;
+    else if (name == "stratified") type = SamplerType::Stratified;
+    else if (name == "sobol") type = SamplerType::Sobol;
+    else if (name == "bluenoise") type = SamplerType::BlueNoise;
+    else return false;
+    return true;
+}
+
+bool Scene::Load(const char* path, string& error)
+{
+    char magic[sizeof(CACHE_MAGIC)] = {};
+    ifstream fin(path, ios::binary);
+    if (!fin)
+    {
+        error = string(path) + ": cannot open";
+        return false;
+    }
+    fin.read(magic, sizeof(magic));
+    fin.close();
+    if (memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0) return LoadBinary(path, error);
+    return LoadText(path, error);
+}
+
+bool Scene::LoadText(const char* path, string& error)
+{
+    Clear();
+    ifstream fin(path, ios::binary);
+    if (!fin)
+    {
+        error = string(path) + ": cannot open";
+        return false;
+    }
+    string text((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+
+    unordered_map<string, int> materialNames;
+    string word, name;
+    int line = 0;
+    const char* p = text.data();
+    const char* end = p + text.size();
+    auto fail = [&](const string& message)
+    {
+        error = string(path) + ":" + to_string(line) + ": " + message;
+        Clear();
+        return false;
+    };
+    while (p < end)
+    {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        LineTokens tokens(p, eol);
+        p = eol + 1;
+        ++line;
+        if (!tokens.Word(word)) continue;
+
+        bool ok = true;
+        if (word == "sphere")
+        {
+            SphereDesc s = {};
+            ok = tokens.Numbers(s.center, 3) && tokens.Number(s.radius) && tokens.Word(name);
+            if (!ok) return fail("expected sphere <x y z> <radius> <material>");
+            auto m = materialNames.find(name);
+            if (m == materialNames.end()) return fail("unknown material " + name);
+            s.material = m->second;
+            ownSpheres.push_back(s);
+        }
+        else if (word == "move")
+        {
+            MotionDesc motion = {};
+            if (ownSpheres.empty()) return fail("move without a sphere above it");
+            ok = tokens.Numbers(motion.velocity, 3);
+            motion.sphere = (int32_t) ownSpheres.size() - 1;
+            ownMotions.push_back(motion);
+        }
+        else if (word == "mesh")
+        {
+            MeshDesc mesh = {};
+            string file;
+            if (!tokens.Word(file) || !tokens.Word(name)) return fail("expected mesh <path> <material>");
+            auto m = materialNames.find(name);
+            if (m == materialNames.end()) return fail("unknown material " + name);
+            // relative to the directory of the scene file
+            string scenePath = path;
+            size_t slash = scenePath.rfind('/');
+            if (file[0] != '/' && slash != string::npos) file = scenePath.substr(0, slash + 1) + file;
+            if (file.size() >= sizeof(mesh.path)) return fail("mesh path too long");
+            strcpy(mesh.path, file.c_str());
+            mesh.material = m->second;
+            ownMeshes.push_back(mesh);
+        }
+        else if (word == "material")
+        {
+            MaterialDesc m = {};
+            string kind;
+            ok = tokens.Word(name) && tokens.Word(kind);
+            if (kind == "lambertian") m.kind = (int32_t) MaterialKind::Lambertian;
+            else if (kind == "metal") m.kind = (int32_t) MaterialKind::Metal;
+            else if (kind == "emissive") m.kind = (int32_t) MaterialKind::Emissive;
+            else if (kind == "glass") m.kind = (int32_t) MaterialKind::Glass;
+            else return fail("unknown material kind " + kind);
+            ok = ok && (m.kind == (int32_t) MaterialKind::Glass ? tokens.Number(m.ior) : tokens.Numbers(m.color, 3));
+            if (m.kind == (int32_t) MaterialKind::Glass) m.color[0] = m.color[1] = m.color[2] = 1;
+            if (!ok) return fail("expected material <name> <kind> <r g b> or <ior> for glass");
+            if (!materialNames.emplace(name, (int) ownMaterials.size()).second)
+            {
+                return fail("material " + name + " defined twice");
+            }
+            ownMaterials.push_back(m);
+        }
+        else if (word == "camera")
+        {
+            ok = tokens.Numbers(settings.lookFrom, 3) && tokens.Numbers(settings.lookAt, 3) &&
+                 tokens.Numbers(settings.vup, 3) && tokens.Number(settings.vfov) && tokens.Number(settings.aperture);
+            settings.focusDist = 0;
+            if (ok && !tokens.AtEnd()) ok = tokens.Number(settings.focusDist);
+        }
+        else if (word == "image")
+        {
+            ok = tokens.Int(settings.nx) && tokens.Int(settings.ny);
+        }
+        else if (word == "samples")
+        {
+            ok = tokens.Int(settings.samples);
+        }
+        else if (word == "depth")
+        {
+            ok = tokens.Int(settings.maxDepth);
+        }
+        else if (word == "sampler")
+        {
+            SamplerType type = SamplerType::Sobol;
+            ok = tokens.Word(name) && ParseSamplerType(name, type);
+            settings.sampler = (int32_t) type;
+        }
+        else if (word == "lights")
+        {
+            ok = tokens.Word(name) && (name == "on" || name == "off");
+            settings.lightSampling = name == "on";
+        }
+        else if (word == "sky")
+        {
+            ok = tokens.Word(name) && (name == "gradient" || name == "sun");
+            settings.sunSky = name == "sun";
+        }
+        else if (word == "output")
+        {
+            ok = tokens.Word(name) && name.size() < sizeof(settings.output);
+            if (ok) strcpy(settings.output, name.c_str());
+        }
+        else if (word == "frames")
+        {
+            ok = tokens.Int(settings.frames);
+        }
+        else if (word == "turntable")
+        {
+            ok = tokens.Number(settings.turntable);
+        }
+        else
+        {
+            return fail("unknown statement " + word);
+        }
+        if (!ok) return fail("bad arguments to " + word);
+        if (!tokens.AtEnd()) return fail("trailing arguments to " + word);
+        string bad = SettingsError(settings);
+        if (!bad.empty()) return fail(bad);
+    }
+    Own();
+    return true;
+}
+
+bool Scene::LoadBinary(const char* path, string& error)
+{
+    Clear();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        error = string(path) + ": cannot open";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(CacheHeader))
+    {
+        close(fd);
+        error = string(path) + ": not a scene cache";
+        return false;
+    }
+    size_t size = (size_t) st.st_size;
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        error = string(path) + ": cannot map";
+        return false;
+    }
+    mapping = p;
+    mappingSize = size;
+    // all of it is read right away to validate and build the objects
+    madvise(p, size, MADV_WILLNEED);
+
+    CacheHeader header;
+    memcpy(&header, p, sizeof(header));
+    auto fits = [size](uint64_t offset, uint64_t count, size_t itemSize)
+    {
+        return offset % CACHE_ALIGN == 0 && offset <= size && count <= (size - offset) / itemSize;
+    };
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+        !fits(header.materialOffset, header.materialCount, sizeof(MaterialDesc)) ||
+        !fits(header.sphereOffset, header.sphereCount, sizeof(SphereDesc)) ||
+        !fits(header.motionOffset, header.motionCount, sizeof(MotionDesc)) ||
+        !fits(header.meshOffset, header.meshCount, sizeof(MeshDesc)))
+    {
+        Clear();
+        error = string(path) + ": not a scene cache of this version";
+        return false;
+    }
+    settings = header.settings;
+    settings.output[sizeof(settings.output) - 1] = 0;
+    string bad = SettingsError(settings);
+    if (!bad.empty())
+    {
+        Clear();
+        error = string(path) + ": bad settings, " + bad;
+        return false;
+    }
+    materials = (const MaterialDesc*) ((const char*) p + header.materialOffset);
+    materialCount = header.materialCount;
+    spheres = (const SphereDesc*) ((const char*) p + header.sphereOffset);
+    sphereCount = header.sphereCount;
+    motions = (const MotionDesc*) ((const char*) p + header.motionOffset);
+    motionCount = header.motionCount;
+    meshes = (const MeshDesc*) ((const char*) p + header.meshOffset);
+    meshCount = header.meshCount;
+
+    // a corrupt cache must not index out of the material table later
+    for (size_t i = 0; i < materialCount; ++i)
+    {
+        if (!ValidKind(materials[i].kind))
+        {
+            Clear();
+            error = string(path) + ": bad material " + to_string(i);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < sphereCount; ++i)
+    {
+        if (spheres[i].material < 0 || (size_t) spheres[i].material >= materialCount)
+        {
+            Clear();
+            error = string(path) + ": bad material of sphere " + to_string(i);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < motionCount; ++i)
+    {
+        if (motions[i].sphere < 0 || (size_t) motions[i].sphere >= sphereCount)
+        {
+            Clear();
+            error = string(path) + ": bad sphere of motion " + to_string(i);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        if (meshes[i].material < 0 || (size_t) meshes[i].material >= materialCount ||
+            !memchr(meshes[i].path, 0, sizeof(meshes[i].path)))
+        {
+            Clear();
+            error = string(path) + ": bad mesh " + to_string(i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Scene::SaveBinary(const char* path, string& error) const
+{
+    // value-initialized: zeroed, padding included, before the settings get their defaults
+    CacheHeader header = CacheHeader();
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.materialCount = materialCount;
+    header.sphereCount = sphereCount;
+    header.motionCount = motionCount;
+    header.meshCount = meshCount;
+    header.materialOffset = AlignUp(sizeof(header));
+    header.sphereOffset = AlignUp(header.materialOffset + materialCount * sizeof(MaterialDesc));
+    header.motionOffset = AlignUp(header.sphereOffset + sphereCount * sizeof(SphereDesc));
+    header.meshOffset = AlignUp(header.motionOffset + motionCount * sizeof(MotionDesc));
+    header.settings = settings;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        error = string(path) + ": cannot create";
+        return false;
+    }
+    const char zeros[CACHE_ALIGN] = {};
+    uint64_t materialsEnd = header.materialOffset + materialCount * sizeof(MaterialDesc);
+    uint64_t spheresEnd = header.sphereOffset + sphereCount * sizeof(SphereDesc);
+    uint64_t motionsEnd = header.motionOffset + motionCount * sizeof(MotionDesc);
+    bool ok = WriteAll(fd, &header, sizeof(header)) &&
+              WriteAll(fd, zeros, header.materialOffset - sizeof(header)) &&
+              WriteAll(fd, materials, materialCount * sizeof(MaterialDesc)) &&
+              WriteAll(fd, zeros, header.sphereOffset - materialsEnd) &&
+              WriteAll(fd, spheres, sphereCount * sizeof(SphereDesc)) &&
+              WriteAll(fd, zeros, header.motionOffset - spheresEnd) &&
+              WriteAll(fd, motions, motionCount * sizeof(MotionDesc)) &&
+              WriteAll(fd, zeros, header.meshOffset - motionsEnd) &&
+              WriteAll(fd, meshes, meshCount * sizeof(MeshDesc));
+    if (close(fd) < 0 || !ok)
+    {
+        error = string(path) + ": write failed";
+        return false;
+    }
+    return true;
+}
+
+int Scene::AddMaterial(MaterialKind kind, const Color& color, double ior)
+{
+    assert(ValidKind((int32_t) kind));
+    MaterialDesc m = {};
+    m.kind = (int32_t) kind;
+    for (int i = 0; i < 3; ++i) m.color[i] = color.e[i];
+    m.ior = ior;
+    Own();
+    ownMaterials.push_back(m);
+    Own();
+    return (int) materialCount - 1;
+}
+
+void Scene::AddSphere(const Vector3& center, double radius, int material)
+{
+    assert(material >= 0 && (size_t) material < materialCount);
+    SphereDesc s = {};
+    for (int i = 0; i < 3; ++i) s.center[i] = center.e[i];
+    s.radius = radius;
+    s.material = material;
+    Own();
+    ownSpheres.push_back(s);
+    Own();
+}
+
+void Scene::AddMesh(const string& path, int material)
+{
+    assert(material >= 0 && (size_t) material < materialCount && path.size() < sizeof(MeshDesc::path));
+    MeshDesc m = {};
+    strcpy(m.path, path.c_str());
+    m.material = material;
+    Own();
+    ownMeshes.push_back(m);
+    Own();
+}
+
+void Scene::AddMotion(int sphere, const Vector3& velocity)
+{
+    assert(sphere >= 0 && (size_t) sphere < sphereCount);
+    MotionDesc m = {};
+    m.sphere = sphere;
+    for (int i = 0; i < 3; ++i) m.velocity[i] = velocity.e[i];
+    Own();
+    ownMotions.push_back(m);
+    Own();
+}
+
+bool Scene::Build(Objects& objects, string& error) const
+{
+    vector<int> ids(materialCount);
+    for (size_t i = 0; i < materialCount; ++i)
+    {
+        const MaterialDesc& m = materials[i];
+        Color color(m.color[0], m.color[1], m.color[2]);
+        switch ((MaterialKind) m.kind)
+        {
+        case MaterialKind::Lambertian: ids[i] = objects.AddMaterial(Lambertian(color)); break;
+        case MaterialKind::Metal: ids[i] = objects.AddMaterial(Metal(color)); break;
+        case MaterialKind::Glass: ids[i] = objects.AddMaterial(Glass(m.ior)); break;
+        case MaterialKind::Emissive: ids[i] = objects.AddMaterial(Emissive(color)); break;
+        default: assert(false);
+        }
+    }
+    objects.Reserve((int) sphereCount);
+    for (size_t i = 0; i < sphereCount; ++i)
+    {
+        const SphereDesc& s = spheres[i];
+        objects.AddSphere({s.center[0], s.center[1], s.center[2]}, s.radius, ids[s.material]);
+    }
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        TriangleMesh mesh;
+        if (!LoadMesh(meshes[i].path, mesh, error)) return false;
+        objects.AddMesh(std::move(mesh), ids[meshes[i].material]);
+    }
+    return true;
+}
+
+void Scene::FrameView(int frame, Vector3& lookFrom, Vector3& lookAt, Vector3& vup) const
+{
+    lookFrom = {settings.lookFrom[0], settings.lookFrom[1], settings.lookFrom[2]};
+    lookAt = {settings.lookAt[0], settings.lookAt[1], settings.lookAt[2]};
+    vup = {settings.vup[0], settings.vup[1], settings.vup[2]};
+    if (settings.turntable == 0) return;
+    // rotate lookFrom about the axis through lookAt along vup (Rodrigues)
+    double angle = settings.turntable * frame * M_PI / 180;
+    Vector3 axis = Vector3(vup).UnitVector();
+    Vector3 d = lookFrom - lookAt;
+    Vector3 rotated = d * cos(angle) + axis.Cross(d) * sin(angle) + axis * (axis.Dot(d) * (1 - cos(angle)));
+    lookFrom = lookAt + rotated;
+}
+
+void Scene::Pose(Objects& objects, int frame, int firstObject) const
+{
+    for (size_t i = 0; i < motionCount; ++i)
+    {
+        const MotionDesc& m = motions[i];
+        const SphereDesc& s = spheres[m.sphere];
+        Vector3 center(s.center[0], s.center[1], s.center[2]);
+        Vector3 velocity(m.velocity[0], m.velocity[1], m.velocity[2]);
+        objects.MoveSphere(firstObject + m.sphere, center + velocity * frame);
+    }
+}
+
+void Scene::Clear()
+{
+    Unmap();
+    ownMaterials.clear();
+    ownSpheres.clear();
+    ownMotions.clear();
+    ownMeshes.clear();
+    Own();
+    settings = RenderSettings();
+}
+
+uint64_t Scene::Fingerprint() const
+{
+    // field by field, the reserved fields and the output path are left out
+    Hasher h;
+    const RenderSettings& s = settings;
+    h.Add(s.lookFrom);
+    h.Add(s.lookAt);
+    h.Add(s.vup);
+    h.Add(s.vfov);
+    h.Add(s.aperture);
+    h.Add(s.focusDist);
+    h.Add(s.turntable);
+    h.Add(s.nx);
+    h.Add(s.ny);
+    h.Add(s.samples);
+    h.Add(s.maxDepth);
+    h.Add(s.sampler);
+    h.Add(s.lightSampling);
+    h.Add(s.sunSky);
+    h.Add(s.frames);
+    h.Add(materialCount);
+    for (size_t i = 0; i < materialCount; ++i)
+    {
+        h.Add(materials[i].kind);
+        h.Add(materials[i].color);
+        h.Add(materials[i].ior);
+    }
+    h.Add(sphereCount);
+    for (size_t i = 0; i < sphereCount; ++i)
+    {
+        h.Add(spheres[i].center);
+        h.Add(spheres[i].radius);
+        h.Add(spheres[i].material);
+    }
+    h.Add(motionCount);
+    for (size_t i = 0; i < motionCount; ++i)
+    {
+        h.Add(motions[i].sphere);
+        h.Add(motions[i].velocity);
+    }
+    h.Add(meshCount);
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        h.Add(meshes[i].path, strnlen(meshes[i].path, sizeof(meshes[i].path)));
+        h.Add(meshes[i].material);
+    }
+    return h.hash;
+}
+
+void Scene::Unmap()
+{
+    if (!mapping) return;
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    materials = nullptr;
+    spheres = nullptr;
+    motions = nullptr;
+    meshes = nullptr;
+    materialCount = sphereCount = motionCount = meshCount = 0;
+}
+
+void Scene::Own()
+{
+    if (mapping)
+    {
+        // a scene changed after loading a cache copies the arrays out of the mapping first
+        ownMaterials.assign(materials, materials + materialCount);
+        ownSpheres.assign(spheres, spheres + sphereCount);
+        ownMotions.assign(motions, motions + motionCount);
+        ownMeshes.assign(meshes, meshes + meshCount);
+        Unmap();
+    }
+    materials = ownMaterials.data();
+    materialCount = ownMaterials.size();
+    spheres = ownSpheres.data();
+    sphereCount = ownSpheres.size();
+    motions = ownMotions.data();
+    motionCount = ownMotions.size();
+    meshes = ownMeshes.data();
+    meshCount = ownMeshes.size();
+}
+
+/* The demo scene: three balls and a glass one on a huge ball, under an emissive sun */
+void BallsScene(Scene& scene)
+{
+    RenderSettings& settings = scene.Settings();
+    Vector3 lookFrom{-5, 0.2, -5};
+    Vector3 lookAt{0, 0, -1};
+    for (int i = 0; i < 3; ++i)
+    {
+        settings.lookFrom[i] = lookFrom.e[i];
+        settings.lookAt[i] = lookAt.e[i];
+    }
+    settings.vfov = 20;
+    settings.aperture = 0.2;
+    settings.nx = 1920;
+    settings.ny = 1080;
+    settings.samples = 100;
+    settings.maxDepth = 50;
+    strcpy(settings.output, "balls.ppm");
+
+    int m1 = scene.AddMaterial(MaterialKind::Lambertian, {0.6, 0.6, 0.8});
+    int m2 = scene.AddMaterial(MaterialKind::Lambertian, {0.8, 0.5, 0.5});
+    int m3 = scene.AddMaterial(MaterialKind::Metal, {0.8, 0.6, 0.2});
+    int m4 = scene.AddMaterial(MaterialKind::Glass, {1, 1, 1}, 1.5);
+    scene.AddSphere({0, 0, -1}, 0.5, m4);
+    scene.AddSphere({0, -1000.5f, -1}, 1000, m1);
+    scene.AddSphere({1, 0, -1}, 0.5, m2);
+    scene.AddSphere({-1, 0, -1}, 0.5, m3);
+
+    // the sun is a light, sampled directly instead of waiting for bounces to find it
+    int sunlight = scene.AddMaterial(MaterialKind::Emissive, {1, 1, 1});
+    scene.AddSphere({-1, 8, -5}, 3, sunlight);
+
+    // fixed seed, the scene is the same on every run
+    Rng rng(2018, 0);
+    for (int i = 0; i < 100; ++i)
+    {
+        int m;
+        double mrand = rng.NextDouble();
+        if (0 <= mrand && mrand < 0.33) m = scene.AddMaterial(MaterialKind::Lambertian, {rng.NextDouble(), rng.NextDouble(), rng.NextDouble()});
+        else if (0.33 <= mrand && mrand < 0.66) m = scene.AddMaterial(MaterialKind::Glass, {1, 1, 1}, 1 + rng.NextDouble());
+        else m = scene.AddMaterial(MaterialKind::Metal, {rng.NextDouble(), rng.NextDouble(), rng.NextDouble()});
+        scene.AddSphere({rng.NextDouble() * 10 - 5, -0.3, rng.NextDouble() * 10 - 5}, 0.2, m);
+    }
+}
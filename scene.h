@@ -0,0 +1,167 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+
+/*
+ * Camera and render settings of a scene. Plain data, stored as is in the
+ * binary scene cache.
+ */
+struct RenderSettings
+{
+    double lookFrom[3] = {0, 0, 0};
+    double lookAt[3] = {0, 0, -1};
+    double vup[3] = {0, 1, 0};
+    double vfov = 90;
+    double aperture = 0;
+    double focusDist = 0;           // 0 for the distance from lookFrom to lookAt
+    double turntable = 0;           // degrees the camera orbits lookAt around vup every frame
+    int32_t nx = 800, ny = 450;
+    int32_t samples = 100;
+    int32_t maxDepth = 50;
+    int32_t sampler = (int32_t) SamplerType::Sobol;
+    int32_t lightSampling = 1;
+    int32_t sunSky = 0;             // ColorSky with its sun instead of ColorSkyGradient
+    int32_t frames = 1;
+    char output[256] = "out.ppm";
+};
+
+/* A built-in material, kind is a MaterialKind other than Other */
+struct MaterialDesc
+{
+    int32_t kind;
+    int32_t reserved;
+    double color[3];                // attenuation or emitted radiance
+    double ior;                     // glass only
+};
+
+struct SphereDesc
+{
+    double center[3];
+    double radius;
+    int32_t material;               // index into the scene's materials
+    int32_t reserved;
+};
+
+/* A sphere moving by velocity every frame */
+struct MotionDesc
+{
+    int32_t sphere;                 // index into the scene's spheres
+    int32_t reserved;
+    double velocity[3];
+};
+
+/* A mesh file, loaded when the scene is built */
+struct MeshDesc
+{
+    char path[256];
+    int32_t material;
+    int32_t reserved;
+};
+
+/**
+ * Scene description: settings, materials, spheres, motions and meshes in flat arrays.
+ *
+ * Text scenes are read line by line, # starts a comment:
+ *
+ *   camera <from x y z> <at x y z> <up x y z> <vfov> <aperture> [focus distance]
+ *   image <width> <height>
+ *   samples <per pixel>
+ *   depth <max bounces>
+ *   sampler independent | stratified | sobol | bluenoise
+ *   lights on | off
+ *   sky gradient | sun
+ *   output <image path>
+ *   frames <count>
+ *   turntable <degrees the camera orbits per frame>
+ *   material <name> lambertian | metal | emissive <r g b>
+ *   material <name> glass <ior>
+ *   sphere <x y z> <radius> <material name>
+ *   move <dx dy dz per frame of the sphere above>
+ *   mesh <.obj or .ply path, relative to the scene file> <material name>
+ *
+ * SaveBinary compiles a scene into a cache file that LoadBinary maps into
+ * memory: the arrays are used where they lie in the mapping, without
+ * parsing or copying, so a large scene is ready as soon as it is mapped.
+ * Caches are only read on machines of the same byte order.
+ */
+class Scene
+{
+public:
+    Scene() = default;
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    ~Scene() { Unmap(); }
+
+    /* Load a text scene or a binary cache, told apart by the cache's magic. False with error set on failure */
+    bool Load(const char* path, std::string& error);
+    bool LoadText(const char* path, std::string& error);
+    bool LoadBinary(const char* path, std::string& error);
+    bool SaveBinary(const char* path, std::string& error) const;
+
+    RenderSettings& Settings() { return settings; }
+    const RenderSettings& Settings() const { return settings; }
+
+    /* Building a scene in code, returns the material's index for AddSphere */
+    int AddMaterial(MaterialKind kind, const Color& color, double ior = 0);
+    void AddSphere(const Vector3& center, double radius, int material);
+    void AddMesh(const std::string& path, int material);
+    void AddMotion(int sphere, const Vector3& velocity);
+
+    const MaterialDesc* Materials() const { return materials; }
+    size_t MaterialCount() const { return materialCount; }
+    const SphereDesc* Spheres() const { return spheres; }
+    size_t SphereCount() const { return sphereCount; }
+    const MotionDesc* Motions() const { return motions; }
+    size_t MotionCount() const { return motionCount; }
+    const MeshDesc* Meshes() const { return meshes; }
+    size_t MeshCount() const { return meshCount; }
+
+    /* Store the materials, spheres and meshes in objects. False with error set if a mesh fails to load */
+    bool Build(Objects& objects, std::string& error) const;
+
+    /* Camera of a frame, lookFrom orbits lookAt with the turntable */
+    void FrameView(int frame, Vector3& lookFrom, Vector3& lookAt, Vector3& vup) const;
+
+    /*
+     * Move the moving spheres of a built scene to where they are in frame.
+     * firstObject is the object index of the scene's first sphere, the
+     * size of objects before Build.
+     */
+    void Pose(Objects& objects, int frame, int firstObject = 0) const;
+
+    /*
+     * Hash of the settings, other than the output path, and of the arrays,
+     * for a checkpoint to tell a render of another scene from its own. A
+     * mesh counts by its path, not by what is in the file.
+     */
+    uint64_t Fingerprint() const;
+protected:
+    void Clear();
+    void Unmap();
+    // point the arrays at the vectors, copied out of the mapping first if there is one
+    void Own();
+
+    RenderSettings settings;
+    const MaterialDesc* materials = nullptr;
+    size_t materialCount = 0;
+    const SphereDesc* spheres = nullptr;
+    size_t sphereCount = 0;
+    const MotionDesc* motions = nullptr;
+    size_t motionCount = 0;
+    const MeshDesc* meshes = nullptr;
+    size_t meshCount = 0;
+    // a text or code built scene owns its arrays, a loaded cache points into the mapping
+    std::vector<MaterialDesc> ownMaterials;
+    std::vector<SphereDesc> ownSpheres;
+    std::vector<MotionDesc> ownMotions;
+    std::vector<MeshDesc> ownMeshes;
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+};
+
+/* Sampler of a scene file name, false if there is none by that name */
+bool ParseSamplerType(const std::string& name, SamplerType& type);
+
+/* The demo scene: three balls and a glass one on a huge ball under an emissive sun, among 100 small random ones */
+void BallsScene(Scene& scene);
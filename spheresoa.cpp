@@ -0,0 +1,229 @@
+#include "spheresoa.h"
+#include "object.h"
+
+#include <immintrin.h>
+
+using namespace std;
+
+// Every kernel evaluates the quadratic exactly like Sphere::IsHit, without
+// fused multiply-adds (avx512f implies fma), so all of them find bit-identical hits.
+#pragma GCC optimize("fp-contract=off")
+
+static int IntersectScalar(const SphereSoA& s, const Ray& r, int first, int count, double minT, double& maxT)
+{
+    Vector3 o = r.Origin(), d = r.Direction();
+    double a = d.Dot(d);
+    double lo = minT + SURFACE_THICKNESS;
+    int best = -1;
+    for (int i = first; i < first + count; ++i)
+    {
+        double ocx = o.e[0] - s.cx[i], ocy = o.e[1] - s.cy[i], ocz = o.e[2] - s.cz[i];
+        double b = ocx * d.e[0] + ocy * d.e[1] + ocz * d.e[2];
+        double c = ocx * ocx + ocy * ocy + ocz * ocz - s.r2[i];
+        double delta = b * b - a * c;
+        if (!(delta > 0)) continue;
+        double sq = sqrt(delta);
+        double root = (-b - sq) / a;
+        if (!(lo < root && root < maxT))
+        {
+            root = (-b + sq) / a;
+            if (!(lo < root && root < maxT)) continue;
+        }
+        maxT = root;
+        best = i;
+    }
+    return best;
+}
+
+__attribute__((target("avx2")))
+static int IntersectAVX2(const SphereSoA& s, const Ray& r, int first, int count, double minT, double& maxT)
+{
+    Vector3 o = r.Origin(), d = r.Direction();
+    const __m256d ox = _mm256_set1_pd(o.e[0]), oy = _mm256_set1_pd(o.e[1]), oz = _mm256_set1_pd(o.e[2]);
+    const __m256d dx = _mm256_set1_pd(d.e[0]), dy = _mm256_set1_pd(d.e[1]), dz = _mm256_set1_pd(d.e[2]);
+    const __m256d a = _mm256_set1_pd(d.Dot(d));
+    const __m256d lo = _mm256_set1_pd(minT + SURFACE_THICKNESS);
+    const __m256d zero = _mm256_setzero_pd(), inf = _mm256_set1_pd(INFINITY);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d lane = _mm256_set_pd(3, 2, 1, 0);
+    int best = -1;
+    for (int base = first; base < first + count; base += 4)
+    {
+        __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&s.cx[base]));
+        __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&s.cy[base]));
+        __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&s.cz[base]));
+        __m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+                                  _mm256_mul_pd(ocz, dz));
+        __m256d c = _mm256_sub_pd(
+                _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+                              _mm256_mul_pd(ocz, ocz)),
+                _mm256_loadu_pd(&s.r2[base]));
+        __m256d delta = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(a, c));
+        __m256d sq = _mm256_sqrt_pd(delta);
+        __m256d nb = _mm256_xor_pd(b, sign);
+        __m256d t1 = _mm256_div_pd(_mm256_sub_pd(nb, sq), a);
+        __m256d t2 = _mm256_div_pd(_mm256_add_pd(nb, sq), a);
+
+        __m256d hi = _mm256_set1_pd(maxT);
+        __m256d valid = _mm256_and_pd(_mm256_cmp_pd(delta, zero, _CMP_GT_OQ),
+                                      _mm256_cmp_pd(lane, _mm256_set1_pd(first + count - base), _CMP_LT_OQ));
+        __m256d ok1 = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(lo, t1, _CMP_LT_OQ),
+                                                         _mm256_cmp_pd(t1, hi, _CMP_LT_OQ)));
+        __m256d ok2 = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(lo, t2, _CMP_LT_OQ),
+                                                         _mm256_cmp_pd(t2, hi, _CMP_LT_OQ)));
+        // the near root wins if it is in range
+        __m256d t = _mm256_blendv_pd(_mm256_blendv_pd(inf, t2, ok2), t1, ok1);
+        if (_mm256_movemask_pd(_mm256_or_pd(ok1, ok2)) == 0) continue;
+
+        alignas(32) double ts[4];
+        _mm256_store_pd(ts, t);
+        for (int l = 0; l < 4; ++l)
+        {
+            if (ts[l] < maxT)
+            {
+                maxT = ts[l];
+                best = base + l;
+            }
+        }
+    }
+    return best;
+}
+
+__attribute__((target("avx512f")))
+static int IntersectAVX512(const SphereSoA& s, const Ray& r, int first, int count, double minT, double& maxT)
+{
+    Vector3 o = r.Origin(), d = r.Direction();
+    const __m512d ox = _mm512_set1_pd(o.e[0]), oy = _mm512_set1_pd(o.e[1]), oz = _mm512_set1_pd(o.e[2]);
+    const __m512d dx = _mm512_set1_pd(d.e[0]), dy = _mm512_set1_pd(d.e[1]), dz = _mm512_set1_pd(d.e[2]);
+    const __m512d a = _mm512_set1_pd(d.Dot(d));
+    const __m512d lo = _mm512_set1_pd(minT + SURFACE_THICKNESS);
+    const __m512d zero = _mm512_setzero_pd(), inf = _mm512_set1_pd(INFINITY);
+    int best = -1;
+    for (int base = first; base < first + count; base += 8)
+    {
+        int left = first + count - base;
+        __mmask8 lanes = (__mmask8) (left >= 8 ? 0xff : (1u << left) - 1);
+        __m512d ocx = _mm512_sub_pd(ox, _mm512_maskz_loadu_pd(lanes, &s.cx[base]));
+        __m512d ocy = _mm512_sub_pd(oy, _mm512_maskz_loadu_pd(lanes, &s.cy[base]));
+        __m512d ocz = _mm512_sub_pd(oz, _mm512_maskz_loadu_pd(lanes, &s.cz[base]));
+        __m512d b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)),
+                                  _mm512_mul_pd(ocz, dz));
+        __m512d c = _mm512_sub_pd(
+                _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)),
+                              _mm512_mul_pd(ocz, ocz)),
+                _mm512_maskz_loadu_pd(lanes, &s.r2[base]));
+        __m512d delta = _mm512_sub_pd(_mm512_mul_pd(b, b), _mm512_mul_pd(a, c));
+        __mmask8 valid = _mm512_mask_cmp_pd_mask(lanes, delta, zero, _CMP_GT_OQ);
+        if (!valid) continue;
+        __m512d sq = _mm512_sqrt_pd(delta);
+        __m512d nb = _mm512_sub_pd(zero, b);
+        __m512d t1 = _mm512_div_pd(_mm512_sub_pd(nb, sq), a);
+        __m512d t2 = _mm512_div_pd(_mm512_add_pd(nb, sq), a);
+
+        __m512d hi = _mm512_set1_pd(maxT);
+        __mmask8 ok1 = _mm512_mask_cmp_pd_mask(_mm512_mask_cmp_pd_mask(valid, lo, t1, _CMP_LT_OQ),
+                                               t1, hi, _CMP_LT_OQ);
+        __mmask8 ok2 = _mm512_mask_cmp_pd_mask(_mm512_mask_cmp_pd_mask(valid, lo, t2, _CMP_LT_OQ),
+                                               t2, hi, _CMP_LT_OQ);
+        if (!(ok1 | ok2)) continue;
+        // the near root wins if it is in range
+        __m512d t = _mm512_mask_blend_pd(ok1, _mm512_mask_blend_pd(ok2, inf, t2), t1);
+
+        alignas(64) double ts[8];
+        _mm512_store_pd(ts, t);
+        for (int l = 0; l < 8; ++l)
+        {
+            if (ts[l] < maxT)
+            {
+                maxT = ts[l];
+                best = base + l;
+            }
+        }
+    }
+    return best;
+}
+
+typedef int (*SphereKernelFn)(const SphereSoA&, const Ray&, int, int, double, double&);
+
+static SimdLevel kernelLevel = DetectSimd();
+static SphereKernelFn kernel = kernelLevel == SimdLevel::AVX512 ? IntersectAVX512 :
+                               kernelLevel == SimdLevel::AVX2 ? IntersectAVX2 : IntersectScalar;
+
+SimdLevel DetectSimd()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    return SimdLevel::Scalar;
+}
+
+void SetSphereKernel(SimdLevel level)
+{
+    SimdLevel best = DetectSimd();
+    kernelLevel = (int) level < (int) best ? level : best;
+    kernel = kernelLevel == SimdLevel::AVX512 ? IntersectAVX512 :
+             kernelLevel == SimdLevel::AVX2 ? IntersectAVX2 : IntersectScalar;
+}
+
+SimdLevel SphereKernel()
+{
+    return kernelLevel;
+}
+
+int SphereKernelWidth()
+{
+    return kernelLevel == SimdLevel::AVX512 ? 8 : kernelLevel == SimdLevel::AVX2 ? 4 : 1;
+}
+
+bool SphereSoA::Build(const std::vector<Object*>& objects, const std::vector<int>& order)
+{
+    Clear();
+    bool allSpheres = true;
+    for (int i: order)
+    {
+        auto* sphere = dynamic_cast<Sphere*>(objects[i]);
+        if (sphere)
+        {
+            Vector3 center = sphere->Center();
+            cx.push_back(center.e[0]);
+            cy.push_back(center.e[1]);
+            cz.push_back(center.e[2]);
+            r2.push_back(sphere->Radius() * sphere->Radius());
+        }
+        else
+        {
+            cx.push_back(NAN);
+            cy.push_back(NAN);
+            cz.push_back(NAN);
+            r2.push_back(0);
+            allSpheres = false;
+        }
+        object.push_back(i);
+    }
+    slot.resize(objects.size());
+    for (int s = 0; s < (int) object.size(); ++s)
+    {
+        slot[object[s]] = s;
+    }
+    // pad so a kernel can load a full register at the end of the last leaf
+    cx.resize(cx.size() + 7, NAN);
+    cy.resize(cy.size() + 7, NAN);
+    cz.resize(cz.size() + 7, NAN);
+    r2.resize(r2.size() + 7, 0);
+    return allSpheres;
+}
+
+void SphereSoA::Clear()
+{
+    cx.clear();
+    cy.clear();
+    cz.clear();
+    r2.clear();
+    object.clear();
+    slot.clear();
+}
+
+int SphereSoA::Intersect(const Ray& r, int first, int count, double minT, double& maxT) const
+{
+    return kernel(*this, r, first, count, minT, maxT);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+
+enum class SimdLevel
+{
+    Scalar,
+    AVX2,       // 4 spheres per test
+    AVX512      // 8 spheres per test
+};
+
+/* Best level the cpu supports */
+SimdLevel DetectSimd();
+
+/* Pick the sphere kernel, levels the cpu lacks fall back to the best supported one */
+void SetSphereKernel(SimdLevel level);
+SimdLevel SphereKernel();
+
+/* Spheres the current kernel tests at once */
+int SphereKernelWidth();
+
+/**
+ * Spheres in structure-of-arrays layout (center, squared radius), kept in
+ * BVH leaf order so the spheres of a leaf are contiguous and can be tested
+ * against a ray a whole SIMD register at a time. Slots holding other
+ * objects have a NaN center and never report a hit.
+ */
+class SphereSoA
+{
+public:
+    /* Lay out objects in the given order, returns false if some are not spheres */
+    bool Build(const std::vector<Object*>& objects, const std::vector<int>& order);
+    void Clear();
+    int Size() const { return (int) object.size(); }
+    size_t Bytes() const
+    {
+        return (cx.capacity() + cy.capacity() + cz.capacity() + r2.capacity()) * sizeof(double) +
+               (object.capacity() + slot.capacity()) * sizeof(int);
+    }
+
+    /* Object index of a slot */
+    int ObjectAt(int slot) const { return object[slot]; }
+
+    /* Update the center of the sphere of object index i after it moved */
+    void Move(int i, const Vector3& center)
+    {
+        int s = slot[i];
+        cx[s] = center.e[0];
+        cy[s] = center.e[1];
+        cz[s] = center.e[2];
+    }
+
+    /*
+     * Closest sphere in slots [first, first + count) hit at a t in
+     * (minT + SURFACE_THICKNESS, maxT). Returns its slot and lowers maxT to
+     * the hit, or -1. Only t is computed, the hit point and normal are left
+     * to the caller for the final closest hit.
+     */
+    int Intersect(const Ray& r, int first, int count, double minT, double& maxT) const;
+
+    std::vector<double> cx, cy, cz, r2;
+    std::vector<int> object;
+    std::vector<int> slot;          // slot of every object index
+};
@@ -8,4 +8,10 @@
 #include <functional>
 #include <thread>
 #include <mutex>
-#include <cstdlib>
\ No newline at end of file
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <cassert>
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads)
+{
+    size = threads > 0 ? threads : (int) thread::hardware_concurrency();
+    size = size > 0 ? size : 1;
+    queues.reset(new WorkQueue[size]);
+    for (int i = 1; i < size; ++i)
+    {
+        this->threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lk(jobMutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto& t: threads)
+    {
+        t.join();
+    }
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int, int)>& fn)
+{
+    if (count <= 0) return;
+    for (int w = 0; w < size; ++w)
+    {
+        lock_guard<mutex> lk(queues[w].lock);
+        queues[w].begin = (int) ((int64_t) count * w / size);
+        queues[w].end = (int) ((int64_t) count * (w + 1) / size);
+    }
+    {
+        lock_guard<mutex> lk(jobMutex);
+        job = &fn;
+        busy = size - 1;
+        ++generation;
+    }
+    jobReady.notify_all();
+
+    RunJob(0);
+
+    unique_lock<mutex> lk(jobMutex);
+    jobDone.wait(lk, [this] { return busy == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::WorkerLoop(int worker)
+{
+    uint64_t seen = 0;
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lk(jobMutex);
+            jobReady.wait(lk, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        RunJob(worker);
+        {
+            lock_guard<mutex> lk(jobMutex);
+            if (--busy == 0) jobDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::RunJob(int worker)
+{
+    int index;
+    while (Pop(worker, index) || (Steal(worker) && Pop(worker, index)))
+    {
+        (*job)(index, worker);
+    }
+}
+
+bool ThreadPool::Pop(int worker, int& index)
+{
+    WorkQueue& q = queues[worker];
+    lock_guard<mutex> lk(q.lock);
+    if (q.begin >= q.end) return false;
+    index = q.begin++;
+    return true;
+}
+
+bool ThreadPool::Steal(int worker)
+{
+    for (int i = 1; i < size; ++i)
+    {
+        WorkQueue& victim = queues[(worker + i) % size];
+        int begin, end;
+        {
+            lock_guard<mutex> lk(victim.lock);
+            int left = victim.end - victim.begin;
+            if (left <= 0) continue;
+            // take the back half, rounded up so a single item can be stolen too
+            begin = victim.end - (left + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        lock_guard<mutex> lk(queues[worker].lock);
+        queues[worker].begin = begin;
+        queues[worker].end = end;
+        return true;
+    }
+    return false;
+}
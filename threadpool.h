@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ * A fixed set of worker threads with a work-stealing scheduler.
+ * ParallelFor splits the index range into one contiguous block per worker;
+ * a worker takes indices from the front of its own block and, once it
+ * runs dry, steals the back half of another worker's block.
+ * The calling thread takes part as worker 0.
+ */
+class ThreadPool
+{
+public:
+    /* threads <= 0 uses one worker per hardware thread */
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int Size() const { return size; }
+
+    /*
+     * Call fn(index, worker) for every index in [0, count) and
+     * return when all calls are done. Must not be nested.
+     */
+    void ParallelFor(int count, const std::function<void(int, int)>& fn);
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        int begin = 0, end = 0;
+        char padding[64];   // keep queues of different workers off one cache line
+    };
+    void WorkerLoop(int worker);
+    void RunJob(int worker);
+    bool Pop(int worker, int& index);
+    bool Steal(int worker);
+
+    int size;
+    std::vector<std::thread> threads;
+    std::unique_ptr<WorkQueue[]> queues;
+
+    std::mutex jobMutex;
+    std::condition_variable jobReady, jobDone;
+    const std::function<void(int, int)>* job = nullptr;
+    uint64_t generation = 0;
+    int busy = 0;
+    bool stopping = false;
+};
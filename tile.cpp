@@ -0,0 +1,60 @@
+#include "tile.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// interleave the bits of x and y
+static uint64_t MortonCode(uint32_t x, uint32_t y)
+{
+    uint64_t code = 0;
+    for (int i = 0; i < 32; ++i)
+    {
+        code |= (uint64_t) ((x >> i) & 1) << (2 * i);
+        code |= (uint64_t) ((y >> i) & 1) << (2 * i + 1);
+    }
+    return code;
+}
+
+std::vector<Tile> MakeTiles(int nx, int ny, int tileSize, TileOrder order)
+{
+    tileSize = tileSize > 0 ? tileSize : 1;
+    int tx = (nx + tileSize - 1) / tileSize;
+    int ty = (ny + tileSize - 1) / tileSize;
+
+    // (sort key, tile index in scanline order)
+    vector<pair<double, int>> keys;
+    keys.reserve(tx * ty);
+    for (int y = 0; y < ty; ++y)
+    {
+        for (int x = 0; x < tx; ++x)
+        {
+            double key = y * tx + x;
+            if (order == TileOrder::Morton)
+            {
+                key = MortonCode(x, y);
+            }
+            else if (order == TileOrder::Spiral)
+            {
+                double dx = x - (tx - 1) / 2.0, dy = y - (ty - 1) / 2.0;
+                double ring = max(fabs(dx), fabs(dy));
+                // ring first, then the angle inside the ring
+                key = ring * 8 + (atan2(dy, dx) + M_PI) / (2 * M_PI);
+            }
+            keys.push_back({key, y * tx + x});
+        }
+    }
+    stable_sort(keys.begin(), keys.end());
+
+    vector<Tile> tiles;
+    tiles.reserve(keys.size());
+    for (auto& k: keys)
+    {
+        int x = k.second % tx, y = k.second / tx;
+        tiles.push_back({
+            x * tileSize, y * tileSize,
+            min(nx, (x + 1) * tileSize), min(ny, (y + 1) * tileSize)
+        });
+    }
+    return tiles;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "stdafx.h"
+
+/* Rectangle of pixels [x0, x1) x [y0, y1) rendered as one work item */
+struct Tile
+{
+    int x0, y0, x1, y1;
+};
+
+enum class TileOrder
+{
+    Scanline,   // row by row
+    Morton,     // z-order curve, neighbouring tiles stay close in the list
+    Spiral      // rings around the image center, center first
+};
+
+/*
+ * Split an nx * ny image into tiles of tileSize * tileSize pixels
+ * (smaller at the right and top borders) in the given order.
+ */
+std::vector<Tile> MakeTiles(int nx, int ny, int tileSize, TileOrder order);
+
+/* How long a tile took and which worker rendered it */
+struct TileTiming
+{
+    Tile tile;
+    double seconds;
+    int worker;
+};
@@ -0,0 +1,109 @@
+#include "wavefront.h"
+#include "material.h"
+#include "rng.h"
+
+using namespace std;
+
+struct WavefrontTracer::Path
+{
+    Ray ray;
+    Vector3 throughput;
+    Rng rng;
+    int index;      // camera ray the path started from
+    int depth;
+    Hit hit;
+};
+
+namespace
+{
+const int KIND_COUNT = (int) MaterialKind::Emissive + 1;
+}
+
+template <MaterialKind K>
+void WavefrontTracer::Shade(const vector<int>& bucket, vector<Path>& paths,
+                            Objects& os, vector<Path>& next, Color* colors) const
+{
+    HitRecord hr;
+    Rng& rng = ThreadRng();
+    for (int i: bucket)
+    {
+        Path& path = paths[i];
+        const MaterialRecord& material = os.MaterialAt(path.hit.object);
+        Color emitted = EmittedBy(material);
+        if (!IsBlack(emitted))
+        {
+            colors[path.index] += path.throughput * emitted;
+        }
+        rng = path.rng;
+        hr.scatterInfos.clear();
+        os.Surface(path.ray, path.hit, 0, hr);
+        ScatterAs<K>(material, path.ray, hr);
+        if (NextBounce(hr, path.depth, rouletteDepth, path.throughput, path.ray) &&
+            path.depth + 1 < maxDepth)
+        {
+            path.rng = rng;
+            ++path.depth;
+            next.push_back(path);
+        }
+    }
+}
+
+int64_t WavefrontTracer::operator()(const Ray* rays, const Rng* rngs, int count,
+                                    Objects& os, Color* colors) const
+{
+    // kept per thread, so a render allocates them once
+    static thread_local vector<Path> paths, next;
+    static thread_local vector<int> misses, buckets[KIND_COUNT];
+
+    paths.clear();
+    for (int i = 0; i < count; ++i)
+    {
+        colors[i] = {0, 0, 0};
+        if (maxDepth > 0)
+        {
+            paths.push_back({rays[i], {1, 1, 1}, rngs[i], i, 0, {0, -1}});
+        }
+    }
+
+    int64_t traced = 0;
+    while (!paths.empty())
+    {
+        // extend
+        for (auto& path: paths)
+        {
+            os.Intersect(path.ray, 0, MAXFLOAT, path.hit);
+        }
+        traced += paths.size();
+
+        misses.clear();
+        for (auto& bucket: buckets)
+        {
+            bucket.clear();
+        }
+        for (int i = 0; i < (int) paths.size(); ++i)
+        {
+            const Hit& hit = paths[i].hit;
+            if (hit.object < 0)
+            {
+                misses.push_back(i);
+            }
+            else
+            {
+                buckets[(int) os.MaterialAt(hit.object).kind].push_back(i);
+            }
+        }
+
+        for (int i: misses)
+        {
+            colors[paths[i].index] += paths[i].throughput * background(paths[i].ray);
+        }
+        next.clear();
+        Shade<MaterialKind::Lambertian>(buckets[(int) MaterialKind::Lambertian], paths, os, next, colors);
+        Shade<MaterialKind::Metal>(buckets[(int) MaterialKind::Metal], paths, os, next, colors);
+        Shade<MaterialKind::Glass>(buckets[(int) MaterialKind::Glass], paths, os, next, colors);
+        Shade<MaterialKind::Emissive>(buckets[(int) MaterialKind::Emissive], paths, os, next, colors);
+        Shade<MaterialKind::Other>(buckets[(int) MaterialKind::Other], paths, os, next, colors);
+        swap(paths, next);
+    }
+    return traced;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "integrator.h"
+
+/**
+ * Wavefront path tracer. Rather than following one path to its end, a
+ * whole batch of paths is advanced a bounce at a time: every live path is
+ * intersected (extend), the hits are bucketed by material kind, and each
+ * bucket is shaded with its material kind's kernel bound statically, which
+ * queues the rays of the next bounce. The estimator and the random numbers
+ * are PathTracer's without light sampling, so both render the same image.
+ * Can be used directly as a BatchColorHandler.
+ */
+class WavefrontTracer
+{
+public:
+    explicit WavefrontTracer(const BackgroundHandler& background) : background(background) { }
+    void SetMaxDepth(int depth) { maxDepth = depth; }
+
+    /* Number of bounces before russian roulette may end a path */
+    void SetRouletteDepth(int depth) { rouletteDepth = depth; }
+
+    /*
+     * Radiance along count camera rays into colors, path i starts with
+     * generator state rngs[i]. Returns the number of rays traced.
+     */
+    int64_t operator()(const Ray* rays, const Rng* rngs, int count, Objects& os, Color* colors) const;
+protected:
+    struct Path;
+    // shade the paths of one bucket, K is the material kind of all of them
+    template <MaterialKind K>
+    void Shade(const std::vector<int>& bucket, std::vector<Path>& paths,
+               Objects& os, std::vector<Path>& next, Color* colors) const;
+
+    BackgroundHandler background;
+    int maxDepth = 50;
+    int rouletteDepth = 3;
+};